@@ -45,7 +45,19 @@ bool Thread::StopThread(void)
 	return false;
 }
 
-bool Thread::StartThread(void)
+/* Wait for a thread started with StartThread(false) to return from main() */
+bool Thread::WaitThread(void)
+{
+	if (tid && !pthread_join(tid, NULL))
+	{
+		tid = 0; //So the destructor doesn't cancel a thread that's gone
+		fThreadRunning = false;
+		return true;
+	}
+	return false;
+}
+
+bool Thread::StartThread(bool Detached)
 {
 	assert(fThreadRunning!=true); //logical error to call StartThread when thread already running
 
@@ -79,7 +91,8 @@ bool Thread::StartThread(void)
 	}
 	else
 	{
-		pthread_detach(tid); //Detach so that when this thread exits, resources are reclaimed
+		if (Detached)
+			pthread_detach(tid); //Detach so that when this thread exits, resources are reclaimed
 		fThreadRunning = true; //So don't start it more than once
 		return true; //success
 	}
@@ -110,3 +123,32 @@ void* Thread::ThreadStarter(void* lpParams)
 
 	return 0;
 }
+
+#ifdef LOCK_PROFILE
+void LockStats::add(const LockStats &rhs)
+{
+	acquires += __atomic_load_n(&rhs.acquires, __ATOMIC_RELAXED);
+	contended += __atomic_load_n(&rhs.contended, __ATOMIC_RELAXED);
+	wait_ns += __atomic_load_n(&rhs.wait_ns, __ATOMIC_RELAXED);
+	hold_ns += __atomic_load_n(&rhs.hold_ns, __ATOMIC_RELAXED);
+	for (unsigned i = 0; i < LOCK_HIST_BUCKETS; i++) {
+		wait_hist[i] += __atomic_load_n(&rhs.wait_hist[i], __ATOMIC_RELAXED);
+		hold_hist[i] += __atomic_load_n(&rhs.hold_hist[i], __ATOMIC_RELAXED);
+	}
+}
+
+/* Print the counts, and the non empty histogram buckets */
+void LockStats::print(FILE *out, const char *name) const
+{
+	unsigned long holds = 0;
+	for (unsigned i = 0; i < LOCK_HIST_BUCKETS; i++)
+		holds += hold_hist[i];
+	fprintf(out, "%s: %lu acquires, %lu contended (%.1f%%), wait %llu ns avg, hold %llu ns avg\n",
+	        name, acquires, contended, acquires ? 100.0 * contended / acquires : 0.0,
+	        contended ? wait_ns / contended : 0ULL, holds ? hold_ns / holds : 0ULL);
+	for (unsigned i = 0; i < LOCK_HIST_BUCKETS; i++)
+		if (wait_hist[i] || hold_hist[i])
+			fprintf(out, "  >= %10llu ns: %10lu waits %10lu holds\n",
+			        i ? 1ULL << i : 0ULL, wait_hist[i], hold_hist[i]);
+}
+#endif //LOCK_PROFILE
@@ -12,6 +12,11 @@
 // Number of MICROseconds between attempts to access a lock
 #define LOCK_CHECK_DELAY    (5000)
 
+// If LOCK_PROFILE is defined, locks can be given a LockStats to count
+// acquires and contention, and time waits and holds. Note it changes the
+// size of the locks, so it must be the same for everything (use -D).
+//#define LOCK_PROFILE
+
 #ifdef WIN32
     #include <cygnus\pthread.h>
 #else
@@ -22,14 +27,76 @@
     #include <errno.h>
     #include <syslog.h>
     #include <unistd.h>
+    #include <sched.h>
+#ifdef __linux__
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+#endif
+#ifdef LOCK_PROFILE
+    #include <time.h>
+#endif
+
+#ifdef LOCK_PROFILE
+/* Lock statistics, which can be shared by a group of locks (like all the
+ * shard locks of a table). Histogram bucket n counts times of
+ * 2^n to 2^(n+1)-1 nanoseconds. Only exclusive holds are timed. */
+#define LOCK_HIST_BUCKETS 32
+
+struct LockStats
+{
+    unsigned long acquires;
+    unsigned long contended;
+    unsigned long long wait_ns;
+    unsigned long long hold_ns;
+    unsigned long wait_hist[LOCK_HIST_BUCKETS];
+    unsigned long hold_hist[LOCK_HIST_BUCKETS];
+
+    LockStats() { reset(); }
+    void reset(void) {
+        acquires = contended = 0;
+        wait_ns = hold_ns = 0;
+        for (unsigned i = 0; i < LOCK_HIST_BUCKETS; i++)
+            wait_hist[i] = hold_hist[i] = 0;
+    }
+    static unsigned long long now(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+    static unsigned bucket(unsigned long long ns) {
+        unsigned b = ns ? 63 - __builtin_clzll(ns) : 0;
+        return b < LOCK_HIST_BUCKETS ? b : LOCK_HIST_BUCKETS - 1;
+    }
+    /* wait is 0 if we got the lock without waiting */
+    void acquired(unsigned long long wait) {
+        __atomic_add_fetch(&acquires, 1, __ATOMIC_RELAXED);
+        if (wait) {
+            __atomic_add_fetch(&contended, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&wait_ns, wait, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&wait_hist[bucket(wait)], 1, __ATOMIC_RELAXED);
+        }
+    }
+    void released(unsigned long long hold) {
+        __atomic_add_fetch(&hold_ns, hold, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&hold_hist[bucket(hold)], 1, __ATOMIC_RELAXED);
+    }
+    void add(const LockStats &rhs);
+    void print(FILE *out, const char *name) const;
+};
+#endif //LOCK_PROFILE
 
+/* Pass ProcessShared to lock between processes, in which case the
+ * CriticalSection must itself be in shared memory. Those are also robust,
+ * so if a process dies holding it the next to enter() gets it.
+ * Note then whatever it protects may have been left half updated,
+ * which enterIntact() tells you about. */
 class CriticalSection
 {
 public:
 
 #ifdef GETOUT_CLAUSE //useful for debugging deadlocks
-    CriticalSection() {
-        pthread_mutex_init(&mutex, NULL);
+    CriticalSection(bool ProcessShared = false) {
+        init(ProcessShared);
 //      mutexNum = mutexCount++;
     }
 
@@ -42,6 +109,10 @@ public:
         int retryCount = 0;
 
         while((result=pthread_mutex_trylock(&mutex)) != 0) {
+            if (result == EOWNERDEAD) {
+                pthread_mutex_consistent(&mutex);
+                break;
+            }
             //DebugMsg(0, "Lock %3d failed for pid %d - retrying\n", mutexNum, (int) getpid());
             usleep(LOCK_CHECK_DELAY);
             if ((GETOUT_CLAUSE * 1000000) <= (LOCK_CHECK_DELAY * ++retryCount)) {
@@ -57,28 +128,380 @@ public:
         //DebugMsg(0, "Lock %3d released by %d\n", mutexNum, (int) getpid());
     }
 #else
-	CriticalSection() {pthread_mutex_init   (&mutex, NULL);}/*TODO: set attr for 1 process*/
+#ifdef LOCK_PROFILE
+	CriticalSection(bool ProcessShared = false) {init(ProcessShared); stats = NULL;}
+#else
+	CriticalSection(bool ProcessShared = false) {init(ProcessShared);}
+#endif
 	~CriticalSection(){pthread_mutex_destroy(&mutex);      }
-	void enter(void)  {pthread_mutex_lock   (&mutex);      }/*TODO: return bool (false if EINVAL(mutex destroyed)), retry on EINTR?*/
+#ifdef LOCK_PROFILE
+    void profile(LockStats *Stats) { stats = Stats; }
+    void enter(void) {
+        if (!stats) {
+            lock();
+            return;
+        }
+        unsigned long long wait = 0;
+        int result = pthread_mutex_trylock(&mutex);
+        if (result == EOWNERDEAD) {
+            pthread_mutex_consistent(&mutex);
+        } else if (result) {
+            unsigned long long start = LockStats::now();
+            lock();
+            wait = (LockStats::now() - start) | 1; //so never 0
+        }
+        stats->acquired(wait);
+        since = LockStats::now();
+    }
+    void leave(void) {
+        if (stats)
+            stats->released(LockStats::now() - since);
+        pthread_mutex_unlock(&mutex);
+    }
+#else
+	void enter(void)  {lock();                             }/*TODO: return bool (false if EINVAL(mutex destroyed)), retry on EINTR?*/
 	void leave(void)  {pthread_mutex_unlock (&mutex);      }
+#endif
     pthread_mutex_t* pthread_mutex(void) { return &mutex; }
 #endif
+    /* enter(), but returning false if the last holder died holding it
+     * (so only if ProcessShared), for those who can repair what it protects.
+     * Waits however long it takes, and isn't profiled. */
+    bool enterIntact(void) {
+        if (pthread_mutex_lock(&mutex) != EOWNERDEAD)
+            return true;
+        pthread_mutex_consistent(&mutex);
+        return false;
+    }
 
 private:
     pthread_mutex_t mutex;
+
+    void init(bool ProcessShared) {
+        if (!ProcessShared) {
+            pthread_mutex_init(&mutex, NULL);
+            return;
+        }
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+    }
+    void lock(void) {
+        if (pthread_mutex_lock(&mutex) == EOWNERDEAD) //holder died
+            pthread_mutex_consistent(&mutex);
+    }
+#if defined(LOCK_PROFILE) && !defined(GETOUT_CLAUSE)
+    LockStats *stats;
+    unsigned long long since;   /* when the holder got it */
+#endif
 //  int mutexNum;
 };
 
+/* A mutex in a single int, for when you've lots of them.
+ * 0 = unlocked, 1 = locked, 2 = locked with (maybe) waiters.
+ * See "Futexes Are Tricky" by Ulrich Drepper.
+ * Note no GETOUT_CLAUSE support, and without futexes
+ * waiters just yield the CPU until the lock is free. */
+class FutexLock
+{
+    int word;
+
+    void wait(void) {
+#ifdef __linux__
+        syscall(SYS_futex, &word, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+#else
+        sched_yield();
+#endif
+    }
+    void wake(void) {
+#ifdef __linux__
+        syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+    }
+
+    public:
+    FutexLock()         {word = 0;}
+    bool tryenter(void) {
+        int c = 0;
+        return __atomic_compare_exchange_n(&word, &c, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    }
+    void enter(void) {
+        if (tryenter())
+            return;
+        while (__atomic_exchange_n(&word, 2, __ATOMIC_ACQUIRE) != 0)
+            wait();
+    }
+    void leave(void) {
+        if (__atomic_exchange_n(&word, 0, __ATOMIC_RELEASE) == 2)
+            wake();
+    }
+};
+
+/* A reader/writer lock in a single int, as for FutexLock.
+ * New readers wait while a writer is waiting, so writers aren't starved.
+ * Waiters set WAITERS and whoever unlocks wakes them all to try again. */
+class FutexRWLock
+{
+    enum { WAITERS = 1U << 31, WRITER = 1U << 30 }; /* the rest count readers */
+    unsigned word;
+
+    void wait(unsigned val) {
+#ifdef __linux__
+        syscall(SYS_futex, &word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+        (void) val;
+        sched_yield();
+#endif
+    }
+    void wakeAll(void) {
+#ifdef __linux__
+        syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, 0x7FFFFFFF, NULL, NULL, 0);
+#endif
+    }
+    /* Note we're waiting on val, and sleep unless it has changed */
+    void waitOn(unsigned val) {
+        if (!(val & WAITERS)) {
+            if (!__atomic_compare_exchange_n(&word, &val, val | WAITERS, false,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                return;
+            val |= WAITERS;
+        }
+        wait(val);
+    }
+
+    public:
+    FutexRWLock()       {word = 0;}
+    bool tryreadlock(void) {
+        unsigned val = __atomic_load_n(&word, __ATOMIC_RELAXED);
+        return !(val & (WRITER | WAITERS)) &&
+               __atomic_compare_exchange_n(&word, &val, val + 1, false,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    }
+    bool trywritelock(void) {
+        unsigned val = 0;
+        return __atomic_compare_exchange_n(&word, &val, WRITER, false,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    }
+    void readlock(void) {
+        for (;;) {
+            unsigned val = __atomic_load_n(&word, __ATOMIC_RELAXED);
+            if (!(val & (WRITER | WAITERS))) {
+                if (__atomic_compare_exchange_n(&word, &val, val + 1, false,
+                                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                    return;
+            } else {
+                waitOn(val);
+            }
+        }
+    }
+    void writelock(void) {
+        for (;;) {
+            unsigned val = __atomic_load_n(&word, __ATOMIC_RELAXED);
+            if (!(val & ~WAITERS)) {
+                if (__atomic_compare_exchange_n(&word, &val, val | WRITER, false,
+                                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                    return;
+            } else {
+                waitOn(val);
+            }
+        }
+    }
+    void unlock(void) {
+        unsigned val = __atomic_load_n(&word, __ATOMIC_RELAXED);
+        if (val & WRITER) {
+            val = __atomic_fetch_and(&word, ~(WRITER | WAITERS), __ATOMIC_RELEASE);
+        } else {
+            val = __atomic_fetch_sub(&word, 1, __ATOMIC_RELEASE);
+            if ((val & ~WAITERS) != 1)
+                return; //other readers still in, the last will wake any waiters
+            val = __atomic_fetch_and(&word, ~WAITERS, __ATOMIC_RELAXED);
+        }
+        if (val & WAITERS)
+            wakeAll();
+    }
+    /* Exclusive, so it can stand in for a CriticalSection */
+    void enter(void)    {writelock();}
+    void leave(void)    {unlock();}
+};
+
 class rwlock
 {
     pthread_rwlock_t lock;
+#ifdef LOCK_PROFILE
+    LockStats *stats;
+    unsigned long long since;   /* when the writer got it, or 0 */
+#endif
+
+    void init(bool ProcessShared, bool PreferWriters) {
+        if (!ProcessShared && !PreferWriters) {
+            pthread_rwlock_init(&lock, NULL);
+            return;
+        }
+#ifdef PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP
+        if (!ProcessShared) { //save the attr calls for each of lots of locks
+            pthread_rwlock_t prefer_writers = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+            lock = prefer_writers;
+            return;
+        }
+#endif
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+        if (ProcessShared)
+            pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef __GLIBC__
+        if (PreferWriters)
+            pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        pthread_rwlock_init(&lock, &attr);
+        pthread_rwlockattr_destroy(&attr);
+    }
 
     public:
-    rwlock()            {pthread_rwlock_init(&lock, NULL);}
+    /* ProcessShared as for CriticalSection, though not robust.
+       By default (on glibc at least) readers can keep a writer waiting
+       indefinitely. With PreferWriters new readers wait behind a waiting
+       writer instead, but then a thread mustn't readlock() recursively. */
+#ifdef LOCK_PROFILE
+    rwlock(bool ProcessShared = false, bool PreferWriters = false) {init(ProcessShared, PreferWriters); stats = NULL; since = 0;}
+#else
+    rwlock(bool ProcessShared = false, bool PreferWriters = false) {init(ProcessShared, PreferWriters);}
+#endif
     ~rwlock()           {pthread_rwlock_destroy(&lock);}
+    bool tryreadlock(void)  {return !pthread_rwlock_tryrdlock(&lock);}
+    bool trywritelock(void) {return !pthread_rwlock_trywrlock(&lock);}
+#ifdef LOCK_PROFILE
+    void profile(LockStats *Stats) { stats = Stats; }
+    void readlock(void) {
+        if (!stats) {
+            pthread_rwlock_rdlock(&lock);
+            return;
+        }
+        unsigned long long wait = 0;
+        if (!tryreadlock()) {
+            unsigned long long start = LockStats::now();
+            pthread_rwlock_rdlock(&lock);
+            wait = (LockStats::now() - start) | 1;
+        }
+        stats->acquired(wait);
+    }
+    void writelock(void) {
+        if (!stats) {
+            pthread_rwlock_wrlock(&lock);
+            return;
+        }
+        unsigned long long wait = 0;
+        if (!trywritelock()) {
+            unsigned long long start = LockStats::now();
+            pthread_rwlock_wrlock(&lock);
+            wait = (LockStats::now() - start) | 1;
+        }
+        stats->acquired(wait);
+        since = LockStats::now();
+    }
+    void unlock(void) {
+        if (stats && since) { //only the writer sees since set
+            stats->released(LockStats::now() - since);
+            since = 0;
+        }
+        pthread_rwlock_unlock(&lock);
+    }
+#else
     void readlock(void) {pthread_rwlock_rdlock(&lock);}
     void writelock(void){pthread_rwlock_wrlock(&lock);}
     void unlock(void)   {pthread_rwlock_unlock(&lock);}
+#endif
+    /* Exclusive, so it can stand in for a CriticalSection */
+    void enter(void)    {writelock();}
+    void leave(void)    {unlock();}
+};
+
+/* A value that threads can update without taking any lock, like a counter
+ * or timestamp. Updates are relaxed by default, so they're just atomic,
+ * not ordered with respect to anything else. So use a lock to keep
+ * several fields consistent with each other. */
+template <typename T> class Atomic
+{
+    T value;
+
+    public:
+    Atomic() { value = T(); }
+    Atomic(T v) { value = v; }
+    Atomic(const Atomic &rhs) { value = rhs.load(); }
+    Atomic &operator=(const Atomic &rhs) { store(rhs.load()); return *this; }
+
+    T load(int order = __ATOMIC_RELAXED) const { return __atomic_load_n(&value, order); }
+    void store(T v, int order = __ATOMIC_RELAXED) { __atomic_store_n(&value, v, order); }
+    /* These return the new value */
+    T add(T n, int order = __ATOMIC_RELAXED) { return __atomic_add_fetch(&value, n, order); }
+    T sub(T n, int order = __ATOMIC_RELAXED) { return __atomic_sub_fetch(&value, n, order); }
+    /* These return the old value */
+    T exchange(T v, int order = __ATOMIC_RELAXED) { return __atomic_exchange_n(&value, v, order); }
+    bool compareExchange(T &expected, T v, int order = __ATOMIC_RELAXED) {
+        return __atomic_compare_exchange_n(&value, &expected, v, false, order, __ATOMIC_RELAXED);
+    }
+    /* Store v if it's bigger, like for a last seen time */
+    void storeMax(T v, int order = __ATOMIC_RELAXED) {
+        T old = load();
+        while (old < v && !compareExchange(old, v, order))
+            ;
+    }
+};
+
+/* Epoch based reclamation for lock free readers.
+ * Readers bracket their accesses with enter()/leave().
+ * Writers unlink shared data, tag it with current() and
+ * can free it once safe(tag) says no reader can still see it.
+ * Readers are spread over a few counters to avoid cache line
+ * ping pong between cores. */
+#define EPOCH_SLOTS 16
+
+class Epoch
+{
+    struct Slot {
+        long active[2]; /* readers in even,odd epochs */
+        char pad[64 - 2*sizeof(long)];
+    } slots[EPOCH_SLOTS];
+    unsigned long epoch;
+
+    static unsigned slotIndex(void) {
+        unsigned long long self = (unsigned long long) pthread_self();
+        return (unsigned) ((self * 0x9E3779B97F4A7C15ULL) >> 60) % EPOCH_SLOTS;
+    }
+
+    public:
+    Epoch() {
+        epoch = 0;
+        for (unsigned i = 0; i < EPOCH_SLOTS; i++)
+            slots[i].active[0] = slots[i].active[1] = 0;
+    }
+    /* returns ticket to pass to leave() */
+    unsigned long enter(void) {
+        unsigned slot = slotIndex();
+        for (;;) {
+            unsigned long e = __atomic_load_n(&epoch, __ATOMIC_SEQ_CST);
+            __atomic_add_fetch(&slots[slot].active[e & 1], 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&epoch, __ATOMIC_SEQ_CST) == e)
+                return (e << 8) | slot;
+            __atomic_sub_fetch(&slots[slot].active[e & 1], 1, __ATOMIC_SEQ_CST);
+        }
+    }
+    void leave(unsigned long ticket) {
+        __atomic_sub_fetch(&slots[ticket & 0xFF].active[(ticket >> 8) & 1], 1, __ATOMIC_RELEASE);
+    }
+    unsigned long current(void) { return __atomic_load_n(&epoch, __ATOMIC_SEQ_CST); }
+    /* Move to the next epoch if nobody is left in the previous one */
+    bool tryAdvance(void) {
+        unsigned long e = current();
+        for (unsigned i = 0; i < EPOCH_SLOTS; i++)
+            if (__atomic_load_n(&slots[i].active[(e + 1) & 1], __ATOMIC_SEQ_CST))
+                return false;
+        return __atomic_compare_exchange_n(&epoch, &e, e + 1, false,
+                                           __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+    bool safe(unsigned long tag) { return current() >= tag + 2; }
 };
 
 class Thread
@@ -87,7 +510,8 @@ public:
 	Thread();
 	virtual ~Thread();
 
-	bool StartThread(void);
+	bool StartThread(bool Detached = true);
+	bool WaitThread(void); /* for threads started with Detached = false */
 	bool StopThread(void);
 	bool PauseThread(void);
 	bool UnPauseThread(void);
@@ -0,0 +1,316 @@
+/* Copyright: Pádraig Brady 2026
+ * Summary: Work stealing thread pool, usable from C and C++
+ * License: LGPL
+ * History:
+ *     18 Oct 2026 : Initial version
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <new>
+
+extern "C" {
+#include "slab.h"
+}
+#include "executor.h"
+#include "PadThreads.h"
+
+/* The deques are plain doubly linked lists of tasks under a lock each,
+   rather than lock free arrays. A worker only contends for its own
+   lock with thieves, which only come when they've nothing else to do. */
+
+enum { TASK_QUEUED, TASK_DONE, TASK_WAITED }; /* WAITED: a waiter may be asleep */
+
+struct _executor_task {
+    executor_func fn;
+    void *arg;
+    executor *e;
+    struct _executor_task *prev;    /* towards the oldest, stolen first */
+    struct _executor_task *next;
+    int state;
+    int refs;                       /* the worker's and the submitter's */
+};
+
+struct ExecutorDeque {
+    CriticalSection lock;
+    executor_task *oldest;
+    executor_task *newest;
+    char pad[64];                   /* keep each worker's lock on its own cache line */
+
+    ExecutorDeque() { oldest = newest = NULL; }
+    void push(executor_task *t);
+    executor_task *pop(void);       /* newest, for the owner */
+    executor_task *steal(void);     /* oldest, for the others */
+};
+
+class ExecutorWorker: public Thread
+{
+public:
+    executor *e;
+    unsigned id;
+    unsigned seed;                  /* for picking who to steal from */
+    ExecutorDeque deque;
+private:
+    void main(void);
+};
+
+struct _executor {
+    ExecutorWorker *workers;
+    unsigned nworkers;
+    unsigned next;                  /* worker for the next task from outside */
+    int pending;                    /* tasks queued but not yet taken */
+    int sleepers;                   /* idle workers waiting on idle */
+    bool stopping;
+    slab *tasks;
+    CriticalSection idleLock;
+    pthread_cond_t idle;
+};
+
+/* The worker the current thread is, if any */
+static __thread ExecutorWorker *current;
+
+static void futexWait(int *word, int val)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+    (void) word; (void) val;
+    sched_yield();
+#endif
+}
+
+static void futexWakeAll(int *word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 0x7FFFFFFF, NULL, NULL, 0);
+#else
+    (void) word;
+#endif
+}
+
+void ExecutorDeque::push(executor_task *t)
+{
+    lock.enter();
+    t->next = NULL;
+    t->prev = newest;
+    if (newest)
+        newest->next = t;
+    else
+        oldest = t;
+    newest = t;
+    lock.leave();
+}
+
+executor_task *ExecutorDeque::pop(void)
+{
+    lock.enter();
+    executor_task *t = newest;
+    if (t) {
+        newest = t->prev;
+        if (newest)
+            newest->next = NULL;
+        else
+            oldest = NULL;
+    }
+    lock.leave();
+    return t;
+}
+
+executor_task *ExecutorDeque::steal(void)
+{
+    lock.enter();
+    executor_task *t = oldest;
+    if (t) {
+        oldest = t->next;
+        if (oldest)
+            oldest->prev = NULL;
+        else
+            newest = NULL;
+    }
+    lock.leave();
+    return t;
+}
+
+static void unrefTask(executor_task *t)
+{
+    if (!__atomic_sub_fetch(&t->refs, 1, __ATOMIC_ACQ_REL))
+        slab_free(t->e->tasks, t);
+}
+
+/* Our own newest task, or else the oldest of another worker,
+   starting from a random one so thieves spread out */
+static executor_task *findTask(ExecutorWorker *self)
+{
+    executor *e = self->e;
+    if (!__atomic_load_n(&e->pending, __ATOMIC_ACQUIRE))
+        return NULL;
+    executor_task *t = self->deque.pop();
+    if (!t) {
+        self->seed = self->seed * 1103515245 + 12345;
+        unsigned start = (self->seed >> 16) % e->nworkers;
+        for (unsigned i = 0; !t && i < e->nworkers; i++) {
+            unsigned victim = (start + i) % e->nworkers;
+            if (victim != self->id)
+                t = e->workers[victim].deque.steal();
+        }
+    }
+    if (t)
+        __atomic_sub_fetch(&e->pending, 1, __ATOMIC_SEQ_CST);
+    return t;
+}
+
+static void runTask(executor_task *t)
+{
+    t->fn(t->arg);
+    if (__atomic_exchange_n(&t->state, TASK_DONE, __ATOMIC_RELEASE) == TASK_WAITED)
+        futexWakeAll(&t->state);
+    unrefTask(t);
+}
+
+void ExecutorWorker::main(void)
+{
+    current = this;
+    for (;;) {
+        executor_task *t = findTask(this);
+        if (t) {
+            runTask(t);
+            continue;
+        }
+        e->idleLock.enter();
+        __atomic_add_fetch(&e->sleepers, 1, __ATOMIC_SEQ_CST);
+        while (!__atomic_load_n(&e->pending, __ATOMIC_SEQ_CST) && !e->stopping)
+            pthread_cond_wait(&e->idle, e->idleLock.pthread_mutex());
+        __atomic_sub_fetch(&e->sleepers, 1, __ATOMIC_SEQ_CST);
+        bool stop = e->stopping && !__atomic_load_n(&e->pending, __ATOMIC_SEQ_CST);
+        e->idleLock.leave();
+        if (stop)
+            return;
+        sched_yield(); //pending may be set just before the task is pushed
+    }
+}
+
+/* Stop the workers once there's nothing left to do */
+static void stopWorkers(executor *e, unsigned started)
+{
+    e->idleLock.enter();
+    e->stopping = true;
+    pthread_cond_broadcast(&e->idle);
+    e->idleLock.leave();
+    for (unsigned i = 0; i < started; i++)
+        e->workers[i].WaitThread();
+}
+
+static void freeExecutor(executor *e)
+{
+    delete[] e->workers;
+    if (e->tasks)
+        slab_delete(e->tasks);
+    pthread_cond_destroy(&e->idle);
+    delete e;
+}
+
+executor *executor_new(unsigned nworkers)
+{
+    if (!nworkers) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nworkers = cpus > 0 ? (unsigned) cpus : 1;
+    }
+    executor *e = new (std::nothrow) executor;
+    if (!e)
+        return NULL;
+    e->nworkers = nworkers;
+    e->next = 0;
+    e->pending = 0;
+    e->sleepers = 0;
+    e->stopping = false;
+    pthread_cond_init(&e->idle, NULL);
+    e->tasks = slab_new(sizeof(executor_task));
+    e->workers = new (std::nothrow) ExecutorWorker[nworkers];
+    if (!e->tasks || !e->workers) {
+        freeExecutor(e);
+        return NULL;
+    }
+
+    unsigned started;
+    for (started = 0; started < nworkers; started++) {
+        ExecutorWorker &w = e->workers[started];
+        w.e = e;
+        w.id = started;
+        w.seed = started + 1;
+        if (!w.StartThread(false))
+            break;
+    }
+    if (started < nworkers) {
+        stopWorkers(e, started);
+        freeExecutor(e);
+        return NULL;
+    }
+    return e;
+}
+
+void executor_delete(executor *e)
+{
+    stopWorkers(e, e->nworkers);
+    freeExecutor(e);
+}
+
+executor_task *executor_submit(executor *e, executor_func fn, void *arg)
+{
+    executor_task *t = (executor_task *) slab_alloc(e->tasks);
+    if (!t)
+        return NULL;
+    t->fn = fn;
+    t->arg = arg;
+    t->e = e;
+    t->state = TASK_QUEUED;
+    t->refs = 2;
+
+    ExecutorWorker *w = current;
+    if (!w || w->e != e) //from outside
+        w = &e->workers[__atomic_fetch_add(&e->next, 1, __ATOMIC_RELAXED) % e->nworkers];
+    /* counted before it's pushed, so a worker that sees
+       no sleepers and nothing pending can't miss it */
+    __atomic_add_fetch(&e->pending, 1, __ATOMIC_SEQ_CST);
+    w->deque.push(t);
+    if (__atomic_load_n(&e->sleepers, __ATOMIC_SEQ_CST)) {
+        e->idleLock.enter();
+        pthread_cond_signal(&e->idle);
+        e->idleLock.leave();
+    }
+    return t;
+}
+
+int executor_done(const executor_task *t)
+{
+    return __atomic_load_n(&t->state, __ATOMIC_ACQUIRE) == TASK_DONE;
+}
+
+/* Workers run other tasks until there are none left to take,
+   and then it's safe to sleep as the task must be running. */
+void executor_wait(executor_task *t)
+{
+    ExecutorWorker *self = current;
+    for (;;) {
+        int state = __atomic_load_n(&t->state, __ATOMIC_ACQUIRE);
+        if (state == TASK_DONE)
+            break;
+        if (self) {
+            executor_task *other = findTask(self);
+            if (other) {
+                runTask(other);
+                continue;
+            }
+        }
+        if (state == TASK_QUEUED &&
+            !__atomic_compare_exchange_n(&t->state, &state, TASK_WAITED, false,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+            continue;
+        futexWait(&t->state, TASK_WAITED);
+    }
+    unrefTask(t);
+}
+
+void executor_detach(executor_task *t)
+{
+    unrefTask(t);
+}
@@ -0,0 +1,62 @@
+/* Copyright: Pádraig Brady 2026
+ * Summary: Work stealing thread pool, usable from C and C++
+ * License: LGPL
+ * History:
+ *     18 Oct 2026 : Initial version
+ */
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Runs lots of short tasks on a fixed number of worker threads (see the
+   Thread class in PadThreads.h), rather than a thread per job. Each worker
+   has its own deque of tasks. Tasks submitted by a task go on its worker's
+   deque and are run newest first, while idle workers steal the oldest tasks
+   from the other deques. Tasks submitted from other threads are spread
+   round robin over the workers.
+
+     static void job(void *arg) { ... }
+
+     executor *e = executor_new(0);
+     executor_task *t = executor_submit(e, job, arg);
+     ...
+     executor_wait(t);
+     executor_delete(e);
+
+   Tasks can submit and wait for other tasks. A worker waiting for a task
+   runs other tasks meanwhile, so workers aren't tied up waiting. */
+
+typedef struct _executor executor;
+typedef struct _executor_task executor_task;
+typedef void (*executor_func)(void *arg);
+
+/* Start nworkers threads, or one per online CPU if 0. ret NULL on fail */
+executor * executor_new(unsigned nworkers);
+
+/* Run what's queued, then stop the workers. Every task must have been
+   executor_wait()ed or executor_detach()ed, as their memory is freed.
+   Don't call it from a task. */
+void executor_delete(executor *e);
+
+/* Queue fn(arg) to be run. Every task returned must be passed to
+   executor_wait() or executor_detach() once. ret NULL on fail */
+executor_task * executor_submit(executor *e, executor_func fn, void *arg);
+
+/* ret nonzero if the task has been run */
+int executor_done(const executor_task *t);
+
+/* Wait for the task to be run, and free it */
+void executor_wait(executor_task *t);
+
+/* Free the task once it has been run, without waiting for it */
+void executor_detach(executor_task *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EXECUTOR_H */
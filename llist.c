@@ -4,6 +4,8 @@
  * History:
  *     02 Sep 2002 : Initial version
  *     10 Nov 2005 : Add llist_reverse()
+ *     18 Oct 2026 : Add llist_detach()
+ *     18 Oct 2026 : Add llist_link()
  */
 
 #include <stdlib.h>
@@ -17,6 +19,12 @@ int llist_add(llist_entry **llist, void *val)
         return 0;
     }
 
+    llist_link(llist, e, val);
+    return 1;
+}
+
+void llist_link(llist_entry **llist, llist_entry *e, void *val)
+{
     e->val = val;
 
     if ((*llist) != NULL) {
@@ -30,8 +38,6 @@ int llist_add(llist_entry **llist, void *val)
         e->next = NULL;
         (*llist) = e;
     }
-
-    return 1;
 }
 
 static void * llist_remove(llist_entry **llist, llist_entry *e)
@@ -80,6 +86,18 @@ void * llist_pop(llist_entry **llist, const void *data, const llist_cmp_func lcf
     }
 }
 
+void llist_detach(llist_entry **llist, llist_entry *e)
+{
+    if (e->prev != NULL) {
+        e->prev->next = e->next;
+    } else {
+        (*llist) = e->next;
+    }
+    if (e->next != NULL) {
+        e->next->prev = e->prev;
+    }
+}
+
 void * llist_find(const llist_entry *llist, const void *data, const llist_cmp_func lcf)
 {
     const llist_entry* ei;
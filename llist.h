@@ -4,6 +4,8 @@
  * History:
  *     02 Sep 2002 : Initial version
  *     10 Nov 2005 : Add llist_reverse()
+ *     18 Oct 2026 : Add llist_detach()
+ *     18 Oct 2026 : Add llist_link()
  */
 
 #ifndef LLIST_H
@@ -26,6 +28,10 @@ typedef int (*llist_cmp_func)(const void *, const void *);
    ret 0 on fail */
 int llist_add(llist_entry **llist, void *val);
 
+/* as above but with an entry allocated by the caller,
+   who should then llist_detach() it rather than llist_pop() it */
+void llist_link(llist_entry **llist, llist_entry *e, void *val);
+
 /* find and return from list first item found */
 void * llist_find(const llist_entry *llist, const void *data, const llist_cmp_func lcf);
 
@@ -34,6 +40,10 @@ void * llist_find(const llist_entry *llist, const void *data, const llist_cmp_fu
    first item in the list is removed */
 void * llist_pop(llist_entry **llist, const void *data, const llist_cmp_func lcf);
 
+/* remove a known entry from the list, leaving freeing it to the caller.
+   e->next is left intact for anyone still traversing. O(1) */
+void llist_detach(llist_entry **llist, llist_entry *e);
+
 /* O(n^2) */
 void llist_sort(llist_entry *llist, const llist_cmp_func lcf);
 
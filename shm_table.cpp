@@ -0,0 +1,421 @@
+/* Copyright: Pádraig Brady 2026
+ * Summary: Table of fixed size records in POSIX shared memory
+ * License: LGPL
+ * History:
+ *     18 Oct 2026 : Initial version
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <new>
+#include "shm_table.h"
+
+/*
+The segment is laid out as
+
+  ShmTableHeader | buckets | slot 0 | slot 1 | ...
+
+and each slot is a ShmTableSlot followed by the record and then the name.
+Slots are handed out in order, and del()eted ones are kept on a free list.
+
+A slot is filled in before it's linked into its bucket, and unlinked before
+it's freed, so if a process dies in the middle of either the chains are
+still sound, but the slot can be on neither them nor the free list. Whoever
+next gets the lock the process died with marks the table damaged, and
+repair() then rebuilds the free list and count from the chains.
+*/
+
+#define SHM_TABLE_MAGIC   "PadShm2"
+#define SHM_TABLE_STRIPES 64        /* bucket locks, bucket n uses n % this */
+#define SHM_TABLE_WAIT    5000      /* ms to wait for another process creating the table */
+
+static inline size_t roundUp(size_t n, size_t to) { return (n + to - 1) & ~(to - 1); }
+
+/* FNV-1a as for TableEntry::hashName(). It must never change
+   as it decides where names are in existing tables. */
+static unsigned hashName(const char *name)
+{
+    unsigned hash = 2166136261U;
+    while (*name) {
+        hash ^= (unsigned char) *name++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+struct ShmTableHeader {
+    char magic[8];
+    unsigned capacity;
+    unsigned nbuckets;          /* a power of 2 */
+    unsigned name_size;
+    unsigned record_size;
+    unsigned slot_size;
+    unsigned lock_size;         /* to catch processes built with different locks */
+    unsigned count;
+    unsigned free;              /* first free slot + 1, or 0 */
+    unsigned used;              /* slots handed out so far */
+    unsigned ready;             /* set once the creator has set up the above */
+    unsigned damaged;           /* set if a process died holding a lock below */
+    CriticalSection allocLock;  /* for the 3 above, taken after the rest */
+    CriticalSection stripes[SHM_TABLE_STRIPES];
+};
+
+struct ShmTableSlot {
+    unsigned next;              /* next slot + 1 in the bucket or free list */
+    unsigned hash;
+    CriticalSection lock;       /* the record's */
+};
+
+#define SHM_TABLE_RECORD roundUp(sizeof(ShmTableSlot), 16) /* offset in the slot */
+
+ShmTable::ShmTable()
+{
+    header = NULL;
+    size = 0;
+    buckets = NULL;
+    slots = NULL;
+}
+
+ShmTable::~ShmTable()
+{
+    close();
+}
+
+inline ShmTableSlot *ShmTable::slot(unsigned n) const
+{
+    return (ShmTableSlot *) (slots + (size_t) n * header->slot_size);
+}
+
+inline void *ShmTable::slotRecord(ShmTableSlot *s) const
+{
+    return (char *) s + SHM_TABLE_RECORD;
+}
+
+inline char *ShmTable::slotName(ShmTableSlot *s) const
+{
+    return (char *) s + SHM_TABLE_RECORD + header->record_size;
+}
+
+bool ShmTable::open(const char *Path, unsigned Capacity, size_t RecordSize, unsigned NameSize)
+{
+    close();
+    if (!Capacity || Capacity > 0x80000000 || !RecordSize || RecordSize > 0x7FFFFFFF || NameSize < 2)
+        return false; //more than 2^31 records would need more buckets than fit in an unsigned
+
+    unsigned nbuckets = SHM_TABLE_STRIPES;
+    while (nbuckets < Capacity)
+        nbuckets *= 2;
+    size_t slot_size = roundUp(SHM_TABLE_RECORD + RecordSize + NameSize, 16);
+    size_t buckets_at = roundUp(sizeof(ShmTableHeader), 64);
+    size_t slots_at = roundUp(buckets_at + nbuckets * sizeof(unsigned), 64);
+    if ((SIZE_MAX - slots_at) / slot_size < Capacity)
+        return false;
+    size_t len = slots_at + Capacity * slot_size;
+
+    int fd = shm_open(Path, O_RDWR | O_CREAT | O_EXCL, 0666);
+    bool creator = fd >= 0;
+    if (!creator) {
+        if (errno != EEXIST || (fd = shm_open(Path, O_RDWR, 0)) < 0)
+            return false;
+        struct stat st;
+        int err;
+        for (unsigned ms = 0; !(err = fstat(fd, &st)) && !st.st_size && ms < SHM_TABLE_WAIT; ms++)
+            usleep(1000); //creator hasn't sized it yet
+        if (err || (size_t) st.st_size != len) { //made with other sizes
+            ::close(fd);
+            return false;
+        }
+    } else if (ftruncate(fd, len)) {
+        ::close(fd);
+        shm_unlink(Path);
+        return false;
+    }
+    void *base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        if (creator)
+            shm_unlink(Path);
+        return false;
+    }
+    header = (ShmTableHeader *) base;
+    size = len;
+    buckets = (unsigned *) ((char *) base + buckets_at);
+    slots = (char *) base + slots_at;
+
+    if (creator) { //ftruncate() zeroed everything
+        memcpy(header->magic, SHM_TABLE_MAGIC, sizeof(header->magic));
+        header->capacity = Capacity;
+        header->nbuckets = nbuckets;
+        header->name_size = NameSize;
+        header->record_size = (unsigned) RecordSize;
+        header->slot_size = (unsigned) slot_size;
+        header->lock_size = sizeof(CriticalSection);
+        new (&header->allocLock) CriticalSection(true);
+        for (unsigned i = 0; i < SHM_TABLE_STRIPES; i++)
+            new (&header->stripes[i]) CriticalSection(true);
+        __atomic_store_n(&header->ready, 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    for (unsigned ms = 0; !__atomic_load_n(&header->ready, __ATOMIC_ACQUIRE); ms++) {
+        if (ms == SHM_TABLE_WAIT) {
+            close();
+            return false;
+        }
+        usleep(1000);
+    }
+    if (memcmp(header->magic, SHM_TABLE_MAGIC, sizeof(header->magic)) ||
+        header->capacity != Capacity || header->name_size != NameSize ||
+        header->record_size != RecordSize || header->lock_size != sizeof(CriticalSection)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ShmTable::close(void)
+{
+    if (header)
+        munmap(header, size);
+    header = NULL;
+    size = 0;
+    buckets = NULL;
+    slots = NULL;
+}
+
+bool ShmTable::remove(const char *Path)
+{
+    return !shm_unlink(Path);
+}
+
+/* Returns Name's slot + 1 (or 0), and in link where that's linked from.
+   Must hold the bucket's stripe lock. */
+unsigned ShmTable::find(const char *Name, unsigned hash, unsigned **link)
+{
+    *link = &buckets[hash & (header->nbuckets - 1)];
+    while (unsigned n = **link) {
+        ShmTableSlot *s = slot(n - 1);
+        if (s->hash == hash && !strcmp(slotName(s), Name))
+            return n;
+        *link = &s->next;
+    }
+    return 0;
+}
+
+/* Take a stripe or allocLock, noting if its last holder died with it */
+void ShmTable::lock(CriticalSection &cs)
+{
+    if (!cs.enterIntact())
+        __atomic_store_n(&header->damaged, 1, __ATOMIC_RELAXED);
+}
+
+/* Leave a stripe lock, repairing the table if that or another was found
+   abandoned. Mustn't hold any other stripe, or any record. */
+void ShmTable::unlock(CriticalSection &stripe)
+{
+    stripe.leave();
+    if (__atomic_load_n(&header->damaged, __ATOMIC_RELAXED))
+        repair();
+}
+
+/* Rebuild the free list and count from the bucket chains, so slots a dead
+   process had taken but not linked, or unlinked but not freed, aren't lost.
+   Chains are cut at any link that doesn't make sense (out of range, looping,
+   in the wrong bucket or with an unterminated name), though inserting and
+   deleting as above shouldn't leave any. Takes every stripe and allocLock,
+   so mustn't hold any of them, or a record another might wait for under them. */
+void ShmTable::repair(void)
+{
+    for (unsigned i = 0; i < SHM_TABLE_STRIPES; i++)
+        header->stripes[i].enterIntact();
+    header->allocLock.enterIntact();
+
+    unsigned used = header->used < header->capacity ? header->used : header->capacity;
+    unsigned char *linked = (unsigned char *) calloc(used / 8 + 1, 1);
+    if (linked && header->damaged) { //else someone else repaired it, or try again later
+        unsigned count = 0;
+        for (unsigned b = 0; b < header->nbuckets; b++) {
+            unsigned *link = &buckets[b];
+            while (unsigned n = *link) {
+                ShmTableSlot *s = slot(n - 1);
+                if (n > used || linked[n / 8] & (1 << n % 8) ||
+                    (s->hash & (header->nbuckets - 1)) != b ||
+                    !memchr(slotName(s), '\0', header->name_size)) {
+                    *link = 0;
+                    break;
+                }
+                linked[n / 8] |= 1 << n % 8;
+                count++;
+                link = &s->next;
+            }
+        }
+        header->free = 0;
+        for (unsigned n = used; n; n--) {
+            if (!(linked[n / 8] & (1 << n % 8))) {
+                slot(n - 1)->next = header->free;
+                header->free = n;
+            }
+        }
+        header->used = used;
+        header->count = count;
+        __atomic_store_n(&header->damaged, 0, __ATOMIC_RELAXED);
+    }
+    free(linked);
+
+    header->allocLock.leave();
+    for (unsigned i = SHM_TABLE_STRIPES; i--; )
+        header->stripes[i].leave();
+}
+
+/* Must hold the slot's stripe lock */
+void ShmTable::freeSlot(unsigned n)
+{
+    lock(header->allocLock);
+    slot(n - 1)->next = header->free;
+    header->free = n;
+    header->count--;
+    header->allocLock.leave();
+}
+
+bool ShmTable::insert(const char *Name, const void *Record, bool replace)
+{
+    if (!header || strlen(Name) >= header->name_size)
+        return false;
+
+    unsigned hash = hashName(Name);
+    CriticalSection &stripe = header->stripes[(hash & (header->nbuckets - 1)) % SHM_TABLE_STRIPES];
+    unsigned *link;
+    bool result = false;
+
+    lock(stripe);
+    unsigned n = find(Name, hash, &link);
+    if (n) {
+        if (replace) {
+            ShmTableSlot *s = slot(n - 1);
+            s->lock.enter();
+            memcpy(slotRecord(s), Record, header->record_size);
+            s->lock.leave();
+            result = true;
+        }
+    } else {
+        lock(header->allocLock);
+        if ((n = header->free)) {
+            header->free = slot(n - 1)->next;
+        } else if (header->used < header->capacity) {
+            new (&slot(header->used)->lock) CriticalSection(true); //before it's counted as used
+            n = ++header->used;
+        }
+        if (n)
+            header->count++;
+        header->allocLock.leave();
+        if (n) { //not full
+            ShmTableSlot *s = slot(n - 1);
+            s->hash = hash;
+            strcpy(slotName(s), Name);
+            memcpy(slotRecord(s), Record, header->record_size);
+            s->next = *link;
+            __atomic_store_n(link, n, __ATOMIC_RELEASE); //only once it's filled in
+            result = true;
+        }
+    }
+    unlock(stripe);
+    return result;
+}
+
+bool ShmTable::add(const char *Name, const void *Record)
+{
+    return insert(Name, Record, false);
+}
+
+bool ShmTable::put(const char *Name, const void *Record)
+{
+    return insert(Name, Record, true);
+}
+
+void *ShmTable::acquire(const char *Name)
+{
+    if (!header)
+        return NULL;
+
+    unsigned hash = hashName(Name);
+    CriticalSection &stripe = header->stripes[(hash & (header->nbuckets - 1)) % SHM_TABLE_STRIPES];
+    unsigned *link;
+    void *Record = NULL;
+
+    lock(stripe);
+    if (unsigned n = find(Name, hash, &link)) {
+        ShmTableSlot *s = slot(n - 1);
+        s->lock.enter();
+        Record = slotRecord(s);
+    }
+    stripe.leave(); //not unlock(), as repair() holding a record could deadlock
+    return Record;
+}
+
+void ShmTable::release(void *Record)
+{
+    ((ShmTableSlot *) ((char *) Record - SHM_TABLE_RECORD))->lock.leave();
+}
+
+bool ShmTable::get(const char *Name, void *Record)
+{
+    void *rec = acquire(Name);
+    if (!rec)
+        return false;
+    memcpy(Record, rec, header->record_size);
+    release(rec);
+    return true;
+}
+
+bool ShmTable::del(const char *Name)
+{
+    if (!header)
+        return false;
+
+    unsigned hash = hashName(Name);
+    CriticalSection &stripe = header->stripes[(hash & (header->nbuckets - 1)) % SHM_TABLE_STRIPES];
+    unsigned *link;
+
+    lock(stripe);
+    unsigned n = find(Name, hash, &link);
+    if (n) {
+        ShmTableSlot *s = slot(n - 1);
+        s->lock.enter(); //wait for anyone using it
+        *link = s->next;
+        s->lock.leave();
+        freeSlot(n);
+    }
+    unlock(stripe);
+    return n != 0;
+}
+
+unsigned ShmTable::walk(ShmTableFunc fn, void *arg)
+{
+    unsigned visited = 0;
+    bool more = true;
+
+    for (unsigned b = 0; header && more && b < header->nbuckets; b++) {
+        CriticalSection &stripe = header->stripes[b % SHM_TABLE_STRIPES];
+        lock(stripe);
+        for (unsigned n = buckets[b]; more && n; ) {
+            ShmTableSlot *s = slot(n - 1);
+            s->lock.enter();
+            more = fn(slotName(s), slotRecord(s), arg);
+            s->lock.leave();
+            visited++;
+            n = s->next;
+        }
+        unlock(stripe);
+    }
+    return visited;
+}
+
+unsigned ShmTable::count(void)
+{
+    return header ? __atomic_load_n(&header->count, __ATOMIC_RELAXED) : 0;
+}
@@ -0,0 +1,90 @@
+/* Copyright: Pádraig Brady 2026
+ * Summary: Table of fixed size records in POSIX shared memory
+ * License: LGPL
+ * History:
+ *     18 Oct 2026 : Initial version
+ */
+
+#ifndef _SHM_TABLE_H
+#define _SHM_TABLE_H
+
+#include <stddef.h>
+#include "PadThreads.h"
+
+/* A table of fixed size records in POSIX shared memory, so that a number of
+   processes can share one copy rather than each keeping their own Table.
+   Everything in the segment is linked by slot number rather than pointer,
+   as each process may map it at a different address, and the locks are
+   process shared and robust. So records must be plain data (no pointers),
+   and names must be shorter than the name size the table was made with.
+
+   There's a lock per group of hash buckets and one per record, with the
+   group's lock taken first while a record is found and locked, so as with
+   Table don't hold one record while getting another from the same table in
+   another thread.
+
+   If a process dies while adding or deleting, the next add(), put(), del()
+   or walk() puts the table's free list and count right, and the add or del
+   has either happened or not. But if a process dies holding a record (in acquire(),
+   put() or walk()), that record may be left half updated, and nothing can
+   tell. So records that must stay consistent should be updated in a way
+   that tolerates that, like a sequence number written last. */
+
+struct ShmTableHeader;
+struct ShmTableSlot;
+
+/* Called for each record by ShmTable::walk(), with the record acquired.
+   Return false to stop the walk. */
+typedef bool (*ShmTableFunc)(const char *Name, void *Record, void *arg);
+
+class ShmTable
+{
+public:
+    ShmTable();
+    ~ShmTable();
+
+    /* Map the shared memory object Path (a name for shm_open() like
+       "/mytable"), first creating it for Capacity records of RecordSize
+       bytes, with names shorter than NameSize, if it doesn't exist.
+       Those opening an existing table must pass the same sizes.
+       Capacity can be at most 2^31. */
+    bool open(const char *Path, unsigned Capacity, size_t RecordSize, unsigned NameSize = 32);
+    /* Unmap it. The table stays for other processes */
+    void close(void);
+    /* Remove the table once everyone has close()d it */
+    static bool remove(const char *Path);
+
+    /* Copy Record into the table as Name. add() fails if Name is already
+       there, put() replaces it. Both fail if the table is full. */
+    bool add(const char *Name, const void *Record);
+    bool put(const char *Name, const void *Record);
+    /* Copy Name's record to Record */
+    bool get(const char *Name, void *Record);
+    bool del(const char *Name);
+    /* For updating a record in place, locked till release()d */
+    void *acquire(const char *Name);
+    void release(void *Record);
+
+    /* Call fn() for each record, in no particular order. fn()
+       mustn't use the table, as some of its locks are held. */
+    unsigned walk(ShmTableFunc fn, void *arg);
+    unsigned count(void);
+
+private:
+    ShmTableHeader *header;
+    size_t size;                /* of the mapping */
+    unsigned *buckets;          /* first slot + 1 in each, 0 if empty */
+    char *slots;
+
+    ShmTableSlot *slot(unsigned n) const;
+    char *slotName(ShmTableSlot *s) const;
+    void *slotRecord(ShmTableSlot *s) const;
+    unsigned find(const char *Name, unsigned hash, unsigned **link);
+    bool insert(const char *Name, const void *Record, bool replace);
+    void freeSlot(unsigned n);
+    void lock(CriticalSection &cs);
+    void unlock(CriticalSection &stripe);
+    void repair(void);
+};
+
+#endif //_SHM_TABLE_H
@@ -0,0 +1,146 @@
+/* Copyright: Pádraig Brady 2026
+ * Summary: Skip list (ordered set)
+ * License: LGPL
+ * History:
+ *     18 Oct 2026 : Initial version
+ */
+
+#include <stdlib.h>
+#include "skiplist.h"
+
+static skiplist_node *skiplist_node_new(unsigned level, void *val)
+{
+    skiplist_node *n = (skiplist_node *) malloc(sizeof(skiplist_node) +
+                                                (level - 1) * sizeof(skiplist_node *));
+    if (n == NULL) {
+        return NULL;
+    }
+    n->val = val;
+    while (level--) {
+        n->next[level] = NULL;
+    }
+    return n;
+}
+
+/* Each level has 1/4 of the nodes of the one below */
+static unsigned skiplist_random_level(skiplist *sl)
+{
+    unsigned level = 1;
+    while (level < SKIPLIST_MAX_LEVEL && (rand_r(&sl->seed) & 3) == 0) {
+        level++;
+    }
+    return level;
+}
+
+skiplist * skiplist_new(const llist_cmp_func cmp)
+{
+    skiplist *sl = (skiplist *) malloc(sizeof(skiplist));
+
+    if (sl == NULL) {
+        return NULL;
+    }
+    sl->head = skiplist_node_new(SKIPLIST_MAX_LEVEL, NULL);
+    if (sl->head == NULL) {
+        free(sl);
+        return NULL;
+    }
+    sl->cmp = cmp;
+    sl->level = 1;
+    sl->count = 0;
+    sl->seed = 1;
+    return sl;
+}
+
+void skiplist_delete(skiplist *sl)
+{
+    skiplist_node *n = sl->head;
+
+    while (n != NULL) {
+        skiplist_node *next = n->next[0];
+        free(n);
+        n = next;
+    }
+    free(sl);
+}
+
+/* Fill update[] with the last node before val at each level */
+static void skiplist_find_update(const skiplist *sl, const void *val, skiplist_node **update)
+{
+    skiplist_node *x = sl->head;
+    int i;
+
+    for (i = sl->level - 1; i >= 0; i--) {
+        while (x->next[i] != NULL && sl->cmp(x->next[i]->val, val) < 0) {
+            x = x->next[i];
+        }
+        update[i] = x;
+    }
+}
+
+int skiplist_add(skiplist *sl, void *val)
+{
+    skiplist_node *update[SKIPLIST_MAX_LEVEL];
+    skiplist_node *n;
+    unsigned level, i;
+
+    skiplist_find_update(sl, val, update);
+
+    level = skiplist_random_level(sl);
+    n = skiplist_node_new(level, val);
+    if (n == NULL) {
+        return 0;
+    }
+    for (i = sl->level; i < level; i++) {
+        update[i] = sl->head;
+    }
+    if (level > sl->level) {
+        sl->level = level;
+    }
+    for (i = 0; i < level; i++) {
+        n->next[i] = update[i]->next[i];
+        update[i]->next[i] = n;
+    }
+    sl->count++;
+    return 1;
+}
+
+int skiplist_pop(skiplist *sl, const void *val)
+{
+    skiplist_node *update[SKIPLIST_MAX_LEVEL];
+    skiplist_node *n;
+    unsigned i;
+
+    skiplist_find_update(sl, val, update);
+
+    n = update[0]->next[0];
+    if (n == NULL || sl->cmp(n->val, val) != 0) {
+        return 0;
+    }
+    for (i = 0; i < sl->level && update[i]->next[i] == n; i++) {
+        update[i]->next[i] = n->next[i];
+    }
+    while (sl->level > 1 && sl->head->next[sl->level - 1] == NULL) {
+        sl->level--;
+    }
+    free(n);
+    sl->count--;
+    return 1;
+}
+
+skiplist_node * skiplist_first(const skiplist *sl)
+{
+    return sl->head->next[0];
+}
+
+skiplist_node * skiplist_seek(const skiplist *sl, const void *data, const llist_cmp_func lcf)
+{
+    skiplist_node *x = sl->head;
+    int i;
+
+    for (i = sl->level - 1; i >= 0; i--) {
+        while (x->next[i] != NULL && lcf(x->next[i]->val, data) < 0) {
+            x = x->next[i];
+        }
+    }
+    return x->next[0];
+}
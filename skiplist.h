@@ -0,0 +1,58 @@
+/* Copyright: Pádraig Brady 2026
+ * Summary: Skip list (ordered set)
+ * License: LGPL
+ * History:
+ *     18 Oct 2026 : Initial version
+ */
+
+#ifndef SKIPLIST_H
+#define SKIPLIST_H
+
+#include "llist.h" /* llist_cmp_func */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SKIPLIST_MAX_LEVEL 32
+
+/* you manage setting/storage for val */
+typedef struct _skiplist_node {
+    void                    *val;   /* payload */
+    struct _skiplist_node   *next[1]; /* really [level] */
+} skiplist_node;
+
+typedef struct _skiplist {
+    llist_cmp_func          cmp;    /* orders the vals. Must be a total order */
+    skiplist_node           *head;
+    unsigned                level;  /* highest level in use */
+    unsigned                count;
+    unsigned                seed;
+} skiplist;
+
+/* ret NULL on fail */
+skiplist * skiplist_new(const llist_cmp_func cmp);
+
+/* Doesn't touch the vals */
+void skiplist_delete(skiplist *sl);
+
+/* ret 0 on fail. O(log n) */
+int skiplist_add(skiplist *sl, void *val);
+
+/* remove val from list, ret 0 if not present. O(log n) */
+int skiplist_pop(skiplist *sl, const void *val);
+
+/* first node in order, NULL if empty */
+skiplist_node * skiplist_first(const skiplist *sl);
+
+/* first node whose val is >= data according to lcf(val, data).
+   lcf must order the same as the list's cmp. O(log n) */
+skiplist_node * skiplist_seek(const skiplist *sl, const void *data, const llist_cmp_func lcf);
+
+#define skiplist_next(node) ((node)->next[0])
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SKIPLIST_H */
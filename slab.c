@@ -0,0 +1,224 @@
+/* Copyright: Pádraig Brady 2026
+ * Summary: Fixed size object allocator, with per thread caches
+ * License: LGPL
+ * History:
+ *     18 Oct 2026 : Initial version
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "slab.h"
+
+/* free objects are linked through their first word */
+typedef struct _slab_free_obj {
+    struct _slab_free_obj   *next;
+} slab_free_obj;
+
+typedef struct _slab_chunk {
+    struct _slab_chunk      *next;
+    /* objects follow, from SLAB_CHUNK_HEADER on */
+} slab_chunk;
+
+#define SLAB_CHUNK_HEADER 16 /* keeps objects 16 byte aligned */
+
+/* a thread's own free objects */
+typedef struct _slab_cache {
+    slab_free_obj           *free;
+    unsigned                count;
+    struct _slab            *slab;
+    struct _slab_cache      *prev;  /* all caches, so slab_delete() can free them */
+    struct _slab_cache      *next;
+} slab_cache;
+
+struct _slab {
+    size_t                  size;
+    pthread_key_t           key;    /* this thread's slab_cache */
+    pthread_mutex_t         lock;   /* for the rest */
+    slab_free_obj           *free;
+    slab_chunk              *chunks;
+    char                    *bump;  /* next unused object in the first chunk */
+    char                    *end;
+    slab_cache              *caches;
+};
+
+/* Give a finished thread's free objects back to everyone.
+   Not called once the slab is deleted, as that deletes the key. */
+static void slab_thread_exit(void *arg)
+{
+    slab_cache *c = (slab_cache *) arg;
+    slab *s = c->slab;
+
+    pthread_mutex_lock(&s->lock);
+    while (c->free != NULL) {
+        slab_free_obj *o = c->free;
+        c->free = o->next;
+        o->next = s->free;
+        s->free = o;
+    }
+    if (c->prev != NULL) {
+        c->prev->next = c->next;
+    } else {
+        s->caches = c->next;
+    }
+    if (c->next != NULL) {
+        c->next->prev = c->prev;
+    }
+    pthread_mutex_unlock(&s->lock);
+    free(c);
+}
+
+slab * slab_new(size_t size)
+{
+    slab *s = (slab *) malloc(sizeof(slab));
+
+    if (s == NULL) {
+        return NULL;
+    }
+    /* keep objects aligned as malloc() would */
+    if (size < sizeof(slab_free_obj)) {
+        size = sizeof(slab_free_obj);
+    }
+    s->size = (size + 15) & ~(size_t) 15;
+    if (pthread_key_create(&s->key, slab_thread_exit)) {
+        free(s);
+        return NULL;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    s->free = NULL;
+    s->chunks = NULL;
+    s->bump = s->end = NULL;
+    s->caches = NULL;
+    return s;
+}
+
+void slab_delete(slab *s)
+{
+    pthread_key_delete(s->key);
+    while (s->caches != NULL) {
+        slab_cache *c = s->caches;
+        s->caches = c->next;
+        free(c);
+    }
+    while (s->chunks != NULL) {
+        slab_chunk *ch = s->chunks;
+        s->chunks = ch->next;
+        free(ch);
+    }
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+}
+
+static slab_cache * slab_get_cache(slab *s)
+{
+    slab_cache *c = (slab_cache *) pthread_getspecific(s->key);
+
+    if (c != NULL) {
+        return c;
+    }
+    c = (slab_cache *) malloc(sizeof(slab_cache));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->free = NULL;
+    c->count = 0;
+    c->slab = s;
+    c->prev = NULL;
+    if (pthread_setspecific(s->key, c)) {
+        free(c);
+        return NULL;
+    }
+    pthread_mutex_lock(&s->lock);
+    c->next = s->caches;
+    if (s->caches != NULL) {
+        s->caches->prev = c;
+    }
+    s->caches = c;
+    pthread_mutex_unlock(&s->lock);
+    return c;
+}
+
+/* Move up to SLAB_BATCH objects to the thread's cache,
+   from those freed by everyone, or from a chunk. */
+static void slab_refill(slab *s, slab_cache *c)
+{
+    unsigned n;
+
+    pthread_mutex_lock(&s->lock);
+    for (n = 0; n < SLAB_BATCH; n++) {
+        slab_free_obj *o = s->free;
+        if (o != NULL) {
+            s->free = o->next;
+        } else {
+            if (s->bump == s->end) {
+                size_t objs = (SLAB_CHUNK - SLAB_CHUNK_HEADER) / s->size;
+                slab_chunk *ch;
+                if (objs < SLAB_BATCH) {
+                    objs = SLAB_BATCH;
+                }
+                ch = (slab_chunk *) malloc(SLAB_CHUNK_HEADER + objs * s->size);
+                if (ch == NULL) {
+                    break;
+                }
+                ch->next = s->chunks;
+                s->chunks = ch;
+                s->bump = (char *) ch + SLAB_CHUNK_HEADER;
+                s->end = s->bump + objs * s->size;
+            }
+            o = (slab_free_obj *) s->bump;
+            s->bump += s->size;
+        }
+        o->next = c->free;
+        c->free = o;
+        c->count++;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+void * slab_alloc(slab *s)
+{
+    slab_cache *c = slab_get_cache(s);
+    slab_free_obj *o;
+
+    if (c == NULL) {
+        return NULL;
+    }
+    if (c->free == NULL) {
+        slab_refill(s, c);
+        if (c->free == NULL) {
+            return NULL;
+        }
+    }
+    o = c->free;
+    c->free = o->next;
+    c->count--;
+    return o;
+}
+
+void slab_free(slab *s, void *obj)
+{
+    slab_cache *c = slab_get_cache(s);
+    slab_free_obj *o = (slab_free_obj *) obj;
+
+    if (c == NULL) { /* give it straight back */
+        pthread_mutex_lock(&s->lock);
+        o->next = s->free;
+        s->free = o;
+        pthread_mutex_unlock(&s->lock);
+        return;
+    }
+    o->next = c->free;
+    c->free = o;
+    /* don't hoard more than 2 batches */
+    if (++c->count > 2 * SLAB_BATCH) {
+        unsigned n;
+        pthread_mutex_lock(&s->lock);
+        for (n = 0; n < SLAB_BATCH; n++) {
+            o = c->free;
+            c->free = o->next;
+            o->next = s->free;
+            s->free = o;
+        }
+        c->count -= SLAB_BATCH;
+        pthread_mutex_unlock(&s->lock);
+    }
+}
@@ -0,0 +1,42 @@
+/* Copyright: Pádraig Brady 2026
+ * Summary: Fixed size object allocator, with per thread caches
+ * License: LGPL
+ * History:
+ *     18 Oct 2026 : Initial version
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Objects are carved from large chunks, so those allocated
+   together are close together, and are only returned to the system
+   by slab_delete(). Each thread keeps a few free objects to itself,
+   so the shared lock is taken once per SLAB_BATCH allocs or frees. */
+#define SLAB_CHUNK (64 * 1024)
+#define SLAB_BATCH 32
+
+typedef struct _slab slab;
+
+/* ret NULL on fail */
+slab * slab_new(size_t size);
+
+/* Frees all the objects, whether slab_free()d or not */
+void slab_delete(slab *s);
+
+/* ret NULL on fail */
+void * slab_alloc(slab *s);
+
+/* obj can be freed by any thread */
+void slab_free(slab *s, void *obj);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLAB_H */
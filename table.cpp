@@ -1,31 +1,245 @@
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <new>
 
 extern "C" {
 #include "llist.h"
+#include "skiplist.h"
+#include "slab.h"
 }
 #include "table.h"
 #include "PadThreads.h"
 
 
-/* Should really turn this into a hash,
-both for speed and standard interface */
+/* Entries are kept in a llist (for walking) and are
+also chained into a hash index on name (for lookups).
+The index is grown as the table grows so that get()
+and del() stay O(1) on average. */
 
-TableEntry::TableEntry()
+#define TABLE_MIN_BUCKETS 64
+#define TABLE_MAX_LOAD    2 /* average entries per bucket before growing */
+
+#ifdef TABLE_SLAB
+/* Entries and list nodes come from slabs of sizes
+   in 16 byte steps, and bigger things from malloc() */
+#define TABLE_SLAB_MAX     512
+#define TABLE_SLAB_CLASSES (TABLE_SLAB_MAX / 16)
+
+static slab *slabs[TABLE_SLAB_CLASSES];
+static pthread_once_t slabs_once = PTHREAD_ONCE_INIT;
+
+static void slabsInit(void)
+{
+    for (unsigned i = 0; i < TABLE_SLAB_CLASSES; i++)
+        if (!(slabs[i] = slab_new((i + 1) * 16)))
+            abort(); //out of mem
+}
+
+static void *tableAlloc(size_t size)
+{
+    if (!size || size > TABLE_SLAB_MAX)
+        return malloc(size);
+    pthread_once(&slabs_once, slabsInit);
+    return slab_alloc(slabs[(size - 1) / 16]);
+}
+
+static void tableFree(void *ptr, size_t size)
+{
+    if (!ptr)
+        return;
+    if (!size || size > TABLE_SLAB_MAX)
+        free(ptr);
+    else
+        slab_free(slabs[(size - 1) / 16], ptr);
+}
+
+void *TableEntry::operator new(size_t size)
+{
+    void *ptr = tableAlloc(size);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void TableEntry::operator delete(void *ptr, size_t size)
+{
+    tableFree(ptr, size);
+}
+#else
+static inline void *tableAlloc(size_t size) { return malloc(size); }
+static inline void tableFree(void *ptr, size_t) { free(ptr); }
+#endif
+
+/* An entry's node in its shard's list, with what walks need to know of
+   it. That's here rather than in the entry to keep entries small, and as
+   a deleted entry's node outlives its place in the list while kept. */
+struct TableNode {
+    llist_entry list;           /* first, so the llist_entry is the node */
+    unsigned long long born;    /* the Table's version when added, see Table::walkStart() */
+    unsigned long long died;    /* and when unlinked if kept for walks, else 0 */
+    TableNode *kept_next;       /* next in the shard's kept list, see Table::purge() */
+};
+
+static inline TableNode *nodeOf(const TableEntry *Entry)
+{
+    return (TableNode *) Entry->node;
+}
+
+static void freeNode(void *node)
+{
+    tableFree(node, sizeof(TableNode));
+}
+
+/* Entries' locks let writers in ahead of new readers, as FutexRWLock does */
+#ifdef TABLE_COMPACT_LOCKS
+#define ENTRY_LOCK_INIT lock()
+#else
+#define ENTRY_LOCK_INIT lock(false, true)
+#endif
+
+TableEntry::TableEntry(): ENTRY_LOCK_INIT
 {
     name = NULL;
+    hash = 0;
+    hash_next = NULL;
+    node = NULL;
+    refs = 1;
+    seq = 0;
+    extra = NULL;
+#ifdef LOCK_PROFILE
+    lock_acquires = lock_contended = 0;
+    lock_wait_ns = lock_since = 0;
+#endif
 }
 
-TableEntry::TableEntry(const TableEntry & rhs)
+TableEntry::TableEntry(const TableEntry & rhs): ENTRY_LOCK_INIT
 {
+    name = NULL;
     if (rhs.name)
-        name = strdup(rhs.name);
+        setName(rhs.name);
+    hash = 0;
+    hash_next = NULL;
+    node = NULL;
+    refs = 1;
+    seq = 0;
+    extra = NULL;
+#ifdef LOCK_PROFILE
+    lock_acquires = lock_contended = 0;
+    lock_wait_ns = lock_since = 0;
+#endif
 }
 
+/* A TableEntryInline's name_buf is gone by now, see ~TableEntryInline() */
 TableEntry::~TableEntry()
 {
-    if (name)
-        free(name);
+    if (extra)
+        free(extra->index_keys);
+    free(extra);
+    free(name);
+}
+
+char *TableEntry::nameBuf(size_t *len) const
+{
+    *len = 0;
+    return NULL;
+}
+
+bool TableEntry::setName(const char *Name)
+{
+    size_t buf_len;
+    char *buf = nameBuf(&buf_len);
+    char *old_name = name;
+    size_t len = strlen(Name);
+    if (len < buf_len) {
+        if (old_name == buf) {
+            memmove(buf, Name, len + 1);
+            return true;
+        }
+        memcpy(buf, Name, len + 1);
+        name = buf;
+    } else if (Name == old_name) {
+        return true;
+    } else {
+        name = strdup(Name);
+        if (!name) {
+            name = old_name;
+            return false;
+        }
+    }
+    if (old_name && old_name != buf)
+        free(old_name);
+    return true;
+}
+
+size_t TableEntry::bytes(void) const
+{
+    size_t buf_len;
+    char *buf = nameBuf(&buf_len);
+    return sizeof(*this) + (extra ? sizeof(*extra) : 0) +
+           (name && name != buf ? strlen(name) + 1 : 0);
+}
+
+/* The entry's extra bookkeeping, made if need be. NULL if out of memory */
+static TableEntryExtra *extraOf(TableEntry *Entry)
+{
+    if (!Entry->extra)
+        Entry->extra = (TableEntryExtra *) calloc(1, sizeof(TableEntryExtra));
+    return Entry->extra;
+}
+
+/* Seconds since boot, for cache expiry. Never 0 */
+static unsigned cacheNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned) ts.tv_sec + 1;
+}
+
+static inline bool cacheExpired(unsigned expires, unsigned now)
+{
+    return (int) (now - expires) >= 0;
+}
+
+static inline bool cacheExpiredEntry(const TableEntry *Entry)
+{
+    return Entry->extra && Entry->extra->expires && cacheExpired(Entry->extra->expires, cacheNow());
+}
+
+/* Mark a cached entry as found, for the clock hand */
+static inline void cacheTouch(TableEntry *Entry)
+{
+    if (Entry->extra && !__atomic_load_n(&Entry->extra->referenced, __ATOMIC_RELAXED))
+        __atomic_store_n(&Entry->extra->referenced, true, __ATOMIC_RELAXED);
+}
+
+bool TableEntry::expireIn(unsigned secs)
+{
+    if (!extraOf(this))
+        return false;
+    extra->expires = cacheNow() + secs;
+    return true;
+}
+
+size_t TableEntry::pack(void *, size_t) const
+{
+    return TABLE_NO_PACK;
+}
+
+bool TableEntry::unpack(const void *, size_t)
+{
+    return false;
+}
+
+TableEntry *TableEntry::clone(void) const
+{
+    return NULL;
 }
 
 int TableEntry::compare(const void *entry1, const void *entry2)	//Used to sort table
@@ -38,37 +252,544 @@ int TableEntry::findName(const void *entry, const void *name)
     return (strcmp(((TableEntry *) entry)->name, (const char *) name));
 }
 
+/* FNV-1a */
+unsigned TableEntry::hashName(const char *name)
+{
+    unsigned hash = 2166136261U;
+    while (*name) {
+        hash ^= (unsigned char) *name++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+#ifdef LOCK_PROFILE
+LockStats TableEntry::lockStats;
+
+/* Lock the entry, counting any contention */
+static void profiledLock(TableEntry *Entry, bool shared)
+{
+    unsigned long long wait = 0;
+    if (!(shared ? Entry->lock.tryreadlock() : Entry->lock.trywritelock())) {
+        unsigned long long start = LockStats::now();
+        if (shared)
+            Entry->lock.readlock();
+        else
+            Entry->lock.writelock();
+        wait = (LockStats::now() - start) | 1;
+        __atomic_add_fetch(&Entry->lock_contended, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&Entry->lock_wait_ns, wait, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&Entry->lock_acquires, 1, __ATOMIC_RELAXED);
+    TableEntry::lockStats.acquired(wait);
+}
+#endif
+
 void TableEntry::acquire(void)
 {
-    lock.enter();
+#ifdef LOCK_PROFILE
+    profiledLock(this, false);
+    lock_since = LockStats::now();
+#else
+    lock.writelock();
+#endif
+    __atomic_store_n(&seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); //seq is odd before any changes are seen
 }
 
 void TableEntry::release(void)
 {
-    lock.leave();
+#ifdef LOCK_PROFILE
+    lockStats.released(LockStats::now() - lock_since);
+#endif
+    __atomic_store_n(&seq, seq + 1, __ATOMIC_RELEASE);
+    lock.unlock();
+}
+
+bool TableEntry::tryAcquire(void)
+{
+    if (!lock.trywritelock())
+        return false;
+#ifdef LOCK_PROFILE
+    __atomic_add_fetch(&lock_acquires, 1, __ATOMIC_RELAXED);
+    lockStats.acquired(0);
+    lock_since = LockStats::now();
+#endif
+    __atomic_store_n(&seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return true;
+}
+
+void TableEntry::acquireShared(void)
+{
+#ifdef LOCK_PROFILE
+    profiledLock(this, true);
+#else
+    lock.readlock();
+#endif
+}
+
+void TableEntry::releaseShared(void)
+{
+    lock.unlock();
 }
 
 /*
 OK the locking here uses a fixed 3 level hierarchy.
 This means that if there is any contention on a TableEntry
 then the whole table is NOT locked. See the locking
-diagram for more info.
+diagram for more info. Each shard has its own copy of
+the table level locks so the hierarchy is per shard.
+
+In TABLE_EPOCH tables readers don't take the table level
+locks at all. Instead writers publish changes with atomic
+stores, and anything a reader could still be looking at
+is retire()d and only freed when the epoch has moved on
+twice, i.e. once every reader that was around has left.
 */
 
-Table::Table()
+static void unrefEntry(void *Entry)
+{
+    ((TableEntry *) Entry)->unref();
+}
+
+/* llist_link() for lists with lock free readers,
+   the node is fully setup before it's made visible */
+static void llist_publish(llist_entry **llist, llist_entry *e, void *val)
+{
+    llist_entry *head = NULL;
+    llist_link(&head, e, val);
+    e->next = *llist;
+    if (*llist)
+        (*llist)->prev = e;
+    __atomic_store_n(llist, e, __ATOMIC_RELEASE);
+}
+
+/* llist_detach() for lists with lock free readers. Those still on
+   e carry on through its next, and the rest never see it */
+static void llist_retract(llist_entry **llist, llist_entry *e)
+{
+    if (e->prev)
+        __atomic_store_n(&e->prev->next, e->next, __ATOMIC_RELEASE);
+    else
+        __atomic_store_n(llist, e->next, __ATOMIC_RELEASE);
+    if (e->next)
+        e->next->prev = e->prev;
+}
+
+/* Deletes and eviction wait for walks of the shard to finish, so let them in
+   ahead of new walks, or they could wait indefinitely on a busy table */
+Table::Shard::Shard(): table_rwlock(false, true)
 {
     table=NULL;
+    buckets=NULL;
+    nbuckets=0;
+    count=0;
+    generation=0;
+    retired=NULL;
+    kept=kept_tail=NULL;
+    order=NULL;
+    bytes=0;
+    hand=0;
+    hits=misses=evictions=expirations=0;
+    filter_lookups=filter_negatives=filter_false_positives=0;
+}
+
+Table::Table(unsigned Shards, unsigned Flags)
+{
+    nshards = Shards ? Shards : 1;
+    shards = new Shard[nshards];
+    flags = Flags;
+    key_hash = NULL;
+    key_of = NULL;
+    map = NULL;
+    nindexes = 0;
+    changes = NULL;
+    nchanges = 0;
+    change_seq = 0;
+    change_oldest = 1;
+    version = 1; //so a kept node's died is never 0
+    oldest_walk = ~0ULL;
+    snapshot_at = 0;
+    live_snapshots = 0;
+    walks = walks_tail = NULL;
+    caching = false;
+    cache_max_entries = 0;
+    cache_max_bytes = 0;
+    cache_ttl = 0;
+    filter = NULL;
+    filter_size = 0;
+#ifdef LOCK_PROFILE
+    for (unsigned i = 0; i < nshards; i++) {
+        shards[i].tableLock.profile(&tableLockStats);
+        shards[i].table_rwlock.profile(&rwlockStats);
+    }
+#endif
+    for (unsigned i = 0; i < nshards && (flags & TABLE_ORDERED); i++) {
+        shards[i].order = skiplist_new(orderCompare);
+        if (!shards[i].order)
+            abort(); //out of mem
+    }
 }
 
 Table::~Table()
 {
-    tableLock.enter();
-    TableEntry* Entry;
-    while ((Entry = (TableEntry *) llist_pop(&table, NULL, NULL))) {
+    mapLock.enter();
+    unmap();
+    mapLock.leave();
+    for (unsigned i = 0; i < nshards; i++) {
+        Shard &shard = shards[i];
+        shard.tableLock.enter();
+        while (shard.table) {
+            llist_entry *node = shard.table;
+            TableEntry *Entry = (TableEntry *) node->val;
+            llist_detach(&shard.table, node);
+            freeNode(node);
+            Entry->acquire();
+            __atomic_and_fetch(&Entry->refs, ~TableEntry::LINKED, __ATOMIC_RELEASE);
+            Entry->release();
+            Entry->unref();
+        }
+        free(shard.buckets);
+        if (shard.order)
+            skiplist_delete(shard.order);
+        while (shard.retired) {
+            Retired *r = shard.retired;
+            shard.retired = r->next;
+            r->destroy(r->ptr);
+            free(r);
+        }
+        shard.tableLock.leave();
+    }
+    delete[] shards;
+    for (unsigned i = 0; i < nindexes; i++)
+        skiplist_delete(indexes[i].list);
+    for (unsigned i = 0; changes && i < nchanges; i++)
+        if (changes[i].Entry)
+            changes[i].Entry->unref();
+    free(changes);
+    free(filter);
+}
+
+/* Entries with the same name are ordered by address
+   so we can find the exact one to remove */
+int Table::orderCompare(const void *entry1, const void *entry2)
+{
+    int ret = TableEntry::compare(entry1, entry2);
+    if (!ret && entry1 != entry2)
+        ret = entry1 < entry2 ? -1 : 1;
+    return ret;
+}
+
+/* Queue something unlinked from the shard to be freed
+   once no reader can be using it. Must hold tableLock. */
+void Table::retire(Shard &shard, void *ptr, void (*destroy)(void *))
+{
+    Retired *r = (Retired *) malloc(sizeof(Retired));
+    if (!r)
+        return; //better to leak than free under a reader
+    r->ptr = ptr;
+    r->destroy = destroy;
+    r->tag = epoch.current();
+    r->next = shard.retired;
+    shard.retired = r;
+}
+
+/* Free whatever retired items are safe to. Must hold tableLock. */
+void Table::reclaim(Shard &shard)
+{
+    epoch.tryAdvance();
+    Retired **link = &shard.retired;
+    while (*link) {
+        Retired *r = *link;
+        if (epoch.safe(r->tag)) {
+            *link = r->next;
+            r->destroy(r->ptr);
+            free(r);
+        } else {
+            link = &r->next;
+        }
+    }
+}
+
+/* Whether Entry is the one looked for, called Key or if there's
+   a match function, with that key */
+static inline bool isKey(const TableEntry *Entry, const void *Key, unsigned hash, TableMatchFunc match)
+{
+    return Entry->hash == hash && (match ? match(Entry, Key) : !TableEntry::findName(Entry, Key));
+}
+
+/* Return the link pointing at the first entry called Key (or that
+   match()es it), or NULL if there is none. Must hold tableLock. */
+TableEntry **Table::Shard::findBucket(const void *Key, unsigned hash, TableMatchFunc match)
+{
+    if (!buckets)
+        return NULL;
+
+    TableEntry **link = &buckets[hash & (nbuckets - 1)];
+    while (*link) {
+        if (isKey(*link, Key, hash, match))
+            return link;
+        link = &(*link)->hash_next;
+    }
+    return NULL;
+}
+
+/* Double the number of buckets and rechain every entry.
+   Must hold tableLock. On allocation failure we just
+   carry on with longer chains.
+   Lock free readers may be misdirected while entries are
+   rechained, so they check generation to see if they
+   need to retry a failed lookup. The new buckets are
+   published before nbuckets so that readers never index
+   past the end of the array they see. */
+void Table::grow(Shard &shard)
+{
+    unsigned new_nbuckets = shard.nbuckets ? shard.nbuckets * 2 : TABLE_MIN_BUCKETS;
+    TableEntry **new_buckets = (TableEntry **) calloc(new_nbuckets, sizeof(TableEntry *));
+    if (!new_buckets)
+        return;
+
+    __atomic_store_n(&shard.generation, shard.generation + 1, __ATOMIC_RELEASE);
+    /* Each old bucket splits into buckets i and i + nbuckets. Entries are
+       appended so the newest of any duplicate names stays first. */
+    for (unsigned i = 0; i < shard.nbuckets; i++) {
+        TableEntry **tails[2] = { &new_buckets[i], &new_buckets[i + shard.nbuckets] };
+        TableEntry *Entry = shard.buckets[i];
+        while (Entry) {
+            TableEntry *next = Entry->hash_next;
+            TableEntry ***tail = &tails[(Entry->hash & (new_nbuckets - 1)) != i];
+            __atomic_store_n(*tail, Entry, __ATOMIC_RELEASE);
+            *tail = &Entry->hash_next;
+            Entry = next;
+        }
+        __atomic_store_n(tails[0], (TableEntry *) NULL, __ATOMIC_RELEASE);
+        __atomic_store_n(tails[1], (TableEntry *) NULL, __ATOMIC_RELEASE);
+    }
+    TableEntry **old_buckets = shard.buckets;
+    __atomic_store_n(&shard.buckets, new_buckets, __ATOMIC_RELEASE);
+    __atomic_store_n(&shard.nbuckets, new_nbuckets, __ATOMIC_RELEASE);
+    __atomic_store_n(&shard.generation, shard.generation + 1, __ATOMIC_RELEASE);
+
+    if (flags & TABLE_EPOCH)
+        retire(shard, old_buckets, free);
+    else
+        free(old_buckets);
+}
+
+/* Find Key without taking tableLock. Must be in an epoch.
+   If we miss while the buckets were being rebuilt, the entry
+   could have been moved from under us, so we look again
+   with the lock held. */
+TableEntry *Table::lookup(Shard &shard, const void *Key, unsigned hash, TableMatchFunc match)
+{
+    unsigned generation = __atomic_load_n(&shard.generation, __ATOMIC_ACQUIRE);
+    unsigned nbuckets = __atomic_load_n(&shard.nbuckets, __ATOMIC_ACQUIRE);
+    TableEntry **buckets = __atomic_load_n(&shard.buckets, __ATOMIC_ACQUIRE);
+    TableEntry *Entry = NULL;
+
+    if (nbuckets) {
+        Entry = __atomic_load_n(&buckets[hash & (nbuckets - 1)], __ATOMIC_ACQUIRE);
+        while (Entry && !isKey(Entry, Key, hash, match))
+            Entry = __atomic_load_n(&Entry->hash_next, __ATOMIC_ACQUIRE);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (!Entry && ((generation & 1) ||
+                   generation != __atomic_load_n(&shard.generation, __ATOMIC_RELAXED))) {
+        shard.tableLock.enter();
+        TableEntry **link = shard.findBucket(Key, hash, match);
+        if (link)
+            Entry = *link;
+        shard.tableLock.leave();
+    }
+    return Entry;
+}
+
+/* Link Entry into the shard. Must hold tableLock. Unless told not to,
+   the add is logChange()d. If born isn't 0, walks see the entry as
+   added then rather than now. */
+bool Table::insert(Shard &shard, TableEntry *Entry, bool log, unsigned long long born)
+{
+    if (shard.count >= shard.nbuckets * TABLE_MAX_LOAD)
+        grow(shard);
+    int result = shard.buckets != NULL;
+    if (result && (key_of || nindexes || caching))
+        result = extraOf(Entry) != NULL;
+    if (result && nindexes)
+        result = indexAdd(Entry);
+    if (result && (flags & TABLE_ORDERED)) {
+        result = skiplist_add(shard.order, Entry);
+        if (!result)
+            indexDel(Entry);
+    }
+    if (result) {
+        TableNode *node = (TableNode *) tableAlloc(sizeof(TableNode));
+        result = node != NULL;
+        if (node) {
+            node->born = born ? born : __atomic_load_n(&version, __ATOMIC_SEQ_CST);
+            node->died = 0;
+            node->kept_next = NULL;
+        }
+        if (node && (flags & TABLE_EPOCH))
+            llist_publish(&shard.table, &node->list, Entry);
+        else if (node)
+            llist_link(&shard.table, &node->list, Entry);
+        if (!result && (flags & TABLE_ORDERED))
+            skiplist_pop(shard.order, Entry);
+        if (!result)
+            indexDel(Entry);
+    }
+    if (result) {
+        Entry->node = shard.table;
+        __atomic_or_fetch(&Entry->refs, TableEntry::LINKED, __ATOMIC_RELEASE);
+        if (key_of)
+            Entry->extra->key = key_of(Entry->name);
+        filterCount(Entry->hash, true); //before get() can find it
+        TableEntry **head = &shard.buckets[Entry->hash & (shard.nbuckets - 1)];
+        Entry->hash_next = *head;
+        __atomic_store_n(head, Entry, __ATOMIC_RELEASE);
+        shard.count++;
+        if (caching) {
+            TableEntryExtra *extra = Entry->extra;
+            extra->charge = cache_max_bytes ? Entry->bytes() : 0;
+            shard.bytes += extra->charge;
+            if (cache_ttl && !extra->expires)
+                extra->expires = cacheNow() + cache_ttl;
+            extra->referenced = true;
+        }
+        if (log)
+            logChange(TABLE_ADDED, Entry);
+    }
+    if (result)
+        return true;
+    else
+        return false;
+}
+
+/* Unlink the first entry called Key (or that match()es it) from the
+   shard and return it. Must hold tableLock. In TABLE_EPOCH tables the
+   entry and its list node must then be bury()d. */
+TableEntry *Table::unlink(Shard &shard, const void *Key, unsigned hash, TableMatchFunc match)
+{
+    TableEntry **link = shard.findBucket(Key, hash, match);
+    if (!link)
+        return NULL;
+    return unlinkAt(shard, link);
+}
+
+/* As above, for the entry *link points to in its hash bucket.
+   If died isn't NULL, it's set to the version the entry was unlinked at. */
+TableEntry *Table::unlinkAt(Shard &shard, TableEntry **link, bool log, unsigned long long *died)
+{
+    TableEntry *Entry = *link;
+    TableNode *node = nodeOf(Entry);
+    __atomic_store_n(link, Entry->hash_next, __ATOMIC_RELEASE);
+    filterCount(Entry->hash, false);
+    /* See walkStart() for why a walk that we don't see here
+       couldn't have seen the entry anyway */
+    unsigned long long v = __atomic_load_n(&version, __ATOMIC_SEQ_CST);
+    bool kept = __atomic_load_n(&oldest_walk, __ATOMIC_SEQ_CST) < v;
+    if (kept) { //until purge()d, along with the list node
+        node->died = v;
+        __atomic_add_fetch(&Entry->refs, 1 | TableEntry::KEPT, __ATOMIC_RELAXED);
+        if (shard.kept_tail)
+            shard.kept_tail->kept_next = node;
+        else
+            __atomic_store_n(&shard.kept, node, __ATOMIC_RELEASE);
+        shard.kept_tail = node;
+    } else if (flags & TABLE_EPOCH) {
+        llist_retract(&shard.table, &node->list);
+    } else {
+        llist_detach(&shard.table, &node->list);
+        freeNode(node);
+        Entry->node = NULL;
+    }
+    if (died)
+        *died = v;
+    shard.count--;
+    if (Entry->extra)
+        shard.bytes -= Entry->extra->charge;
+    __atomic_and_fetch(&Entry->refs, ~TableEntry::LINKED, __ATOMIC_RELEASE);
+    if ((flags & TABLE_ORDERED) && !kept)
+        skiplist_pop(shard.order, Entry);
+    indexDel(Entry);
+    if (log)
+        logChange(TABLE_DELETED, Entry);
+    return Entry;
+}
+
+/* Must hold tableLock */
+void Table::bury(Shard &shard, TableEntry *Entry)
+{
+    if (!(Entry->refs & TableEntry::KEPT)) //else purge() retires the node
+        retire(shard, Entry->node, freeNode);
+    retire(shard, Entry, unrefEntry);
+}
+
+/* Take the entries kept for walks that have all finished now off the list.
+   Must hold tableLock. Returns their nodes for the caller to free and unref()
+   the entries once it has released tableLock, chained through kept_next,
+   or in TABLE_EPOCH tables NULL as they're retire()d for lock free walkers. */
+TableNode *Table::purge(Shard &shard)
+{
+    TableNode *gone = NULL;
+    unsigned long long oldest = __atomic_load_n(&oldest_walk, __ATOMIC_SEQ_CST);
+    TableNode *node;
+    while ((node = shard.kept) && node->died <= oldest) {
+        TableEntry *Entry = (TableEntry *) node->list.val;
+        __atomic_store_n(&shard.kept, node->kept_next, __ATOMIC_RELEASE);
+        if (!shard.kept)
+            shard.kept_tail = NULL;
+        if (flags & TABLE_ORDERED)
+            skiplist_pop(shard.order, Entry);
+        if (flags & TABLE_EPOCH) {
+            llist_retract(&shard.table, &node->list);
+            retire(shard, node, freeNode);
+            retire(shard, Entry, unrefEntry);
+        } else {
+            llist_detach(&shard.table, &node->list);
+            node->kept_next = gone;
+            gone = node;
+        }
+    }
+    return gone;
+}
+
+/* Wait for current holders of an unlinked entry. Any waiting
+   for it then see it's gone, as it's no longer linked(). */
+static void killEntry(TableEntry *Entry)
+{
+    Entry->acquire();
+    Entry->release();
+}
+
+static inline void acquireEntry(TableEntry *Entry, bool shared)
+{
+    if (shared)
+        Entry->acquireShared();
+    else
         Entry->acquire();
-        delete Entry;
+}
+
+static inline void releaseEntry(TableEntry *Entry, bool shared)
+{
+    if (shared)
+        Entry->releaseShared();
+    else
+        Entry->release();
+}
+
+/* Acquire an entry found by a lock free reader */
+static TableEntry *acquireLive(TableEntry *Entry, bool shared)
+{
+    if (Entry) {
+        acquireEntry(Entry, shared);
+        if (!Entry->linked()) { //del()eted while we were waiting
+            releaseEntry(Entry, shared);
+            Entry = NULL;
+        }
     }
-    tableLock.leave();
+    return Entry;
 }
 
 /*
@@ -81,45 +802,177 @@ bool Table::add(TableEntry * Entry)
     // Nameless objects CANNOT be part of a table
     if (!Entry->name)
         return false;
-    tableLock.enter();
-    int result = llist_add(&table, Entry);
-    tableLock.leave();
-    if (result)
-        return true;
-    else
-        return false;
+    Entry->hash = hashOf(Entry->name);
+    Shard &shard = shardOf(Entry->hash);
+    shard.tableLock.enter();
+    bool result = insert(shard, Entry);
+    shard.tableLock.leave();
+    if (caching)
+        evict(shard);
+    return result;
 }
 
-TableEntry *Table::get(const char *Name)
+/* Find Key and acquire it (shared or not) or just ref() it */
+TableEntry *Table::findLoaded(const void *Key, unsigned hash, int mode, TableMatchFunc match)
 {
-    if (!Name)
-        return NULL;
+    Shard &shard = shardOf(hash);
+    TableEntry *Entry = NULL;
 
-    TableEntry *Entry;
-    tableLock.enter();
-    Entry = (TableEntry *) llist_find(table, Name, TableEntry::findName);
-    if (Entry)
-        Entry->acquire();
-    tableLock.leave();
+    if (flags & TABLE_EPOCH) {
+        unsigned long ticket = epoch.enter();
+        Entry = lookup(shard, Key, hash, match);
+        if (mode == FIND_REF) {
+            if (Entry && !Entry->linked())
+                Entry = NULL; //del()eted, but the epoch keeps it from being freed
+            if (Entry)
+                Entry->ref();
+        } else {
+            Entry = acquireLive(Entry, mode == FIND_SHARED);
+        }
+        epoch.leave(ticket);
+        return Entry;
+    }
+
+    shard.tableLock.enter();
+    TableEntry **link = shard.findBucket(Key, hash, match);
+    if (link)
+        Entry = *link;
+    if (Entry) {
+        if (mode == FIND_REF)
+            Entry->ref();
+        else
+            acquireEntry(Entry, mode == FIND_SHARED);
+    }
+    shard.tableLock.leave();
+
+    return Entry;
+}
 
+/* As above, but also look in any load()ed snapshot by name */
+TableEntry *Table::find(const void *Key, unsigned hash, int mode, TableMatchFunc match)
+{
+    Shard &shard = shardOf(hash);
+    TableEntry *Entry = NULL;
+    if (filterMaybe(shard, hash)) {
+        Entry = findLoaded(Key, hash, mode, match);
+        if (!Entry && !match && __atomic_load_n(&map, __ATOMIC_ACQUIRE) && faultIn((const char *) Key, hash))
+            Entry = findLoaded(Key, hash, mode);
+        if (!Entry && __atomic_load_n(&filter, __ATOMIC_ACQUIRE))
+            __atomic_add_fetch(&shard.filter_false_positives, 1, __ATOMIC_RELAXED);
+    }
+    if (caching) {
+        if (Entry && cacheExpiredEntry(Entry)) {
+            if (mode == FIND_REF)
+                Entry->unref();
+            else
+                releaseEntry(Entry, mode == FIND_SHARED);
+            Entry = NULL; //left for evict() to clear out
+        }
+        if (Entry) {
+            cacheTouch(Entry);
+            __atomic_add_fetch(&shard.hits, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_add_fetch(&shard.misses, 1, __ATOMIC_RELAXED);
+        }
+    }
     return Entry;
 }
 
+TableEntry *Table::get(const char *Name)
+{
+    return Name ? find(Name, hashOf(Name), FIND_EXCLUSIVE) : NULL;
+}
+
+TableEntry *Table::getShared(const char *Name)
+{
+    return Name ? find(Name, hashOf(Name), FIND_SHARED) : NULL;
+}
+
+TableEntry *Table::peek(const char *Name)
+{
+    return Name ? find(Name, hashOf(Name), FIND_REF) : NULL;
+}
+
 bool Table::del(const char *Name)
 {
-    if (!Name)
+    return Name ? delHashed(Name, hashOf(Name), NULL) : false;
+}
+
+void Table::setKeys(TableHashFunc Hash, TableKeyOfFunc KeyOf)
+{
+    key_hash = Hash;
+    key_of = KeyOf;
+}
+
+TableEntry *Table::getMatch(const void *Key, unsigned hash, TableMatchFunc match)
+{
+    return find(Key, hash, FIND_EXCLUSIVE, match);
+}
+
+TableEntry *Table::getMatchShared(const void *Key, unsigned hash, TableMatchFunc match)
+{
+    return find(Key, hash, FIND_SHARED, match);
+}
+
+TableEntry *Table::peekMatch(const void *Key, unsigned hash, TableMatchFunc match)
+{
+    return find(Key, hash, FIND_REF, match);
+}
+
+bool Table::delMatch(const void *Key, unsigned hash, TableMatchFunc match)
+{
+    return delHashed(Key, hash, match);
+}
+
+bool Table::delHashed(const void *Key, unsigned hash, TableMatchFunc match)
+{
+    Shard &shard = shardOf(hash);
+    if (!filterMaybe(shard, hash))
         return false;
+    /* If it's not loaded it may be in a load()ed file still, unless a get()
+       has just faulted it in, in which case it's now loaded after all */
+    bool in_map = !match && mapped();
+    if (delLoaded(Key, hash, match) ||
+        (in_map && (unmapName((const char *) Key, hash) || delLoaded(Key, hash))))
+        return true;
+    if (__atomic_load_n(&filter, __ATOMIC_ACQUIRE))
+        __atomic_add_fetch(&shard.filter_false_positives, 1, __ATOMIC_RELAXED);
+    return false;
+}
 
-    TableEntry *Entry;
-    table_rwlock.writelock();
-    tableLock.enter();
-    Entry = (TableEntry *) llist_pop(&table, Name, TableEntry::findName);
+bool Table::delLoaded(const void *Key, unsigned hash, TableMatchFunc match)
+{
+    Shard &shard = shardOf(hash);
+    TableEntry *Entry = NULL;
+
+    if (flags & TABLE_EPOCH) {
+        shard.tableLock.enter();
+        Entry = unlink(shard, Key, hash, match);
+        shard.tableLock.leave();
+        if (!Entry)
+            return false;
+
+        killEntry(Entry);
+
+        shard.tableLock.enter();
+        bury(shard, Entry);
+        reclaim(shard);
+        shard.tableLock.leave();
+        return true;
+    }
+
+    bool walkers = !(flags & (TABLE_SNAPSHOT | TABLE_ORDERED)); //that we need to wait for
+    if (walkers)
+        shard.table_rwlock.writelock();
+    shard.tableLock.enter();
+    Entry = unlink(shard, Key, hash, match);
     if (Entry) {
-        Entry->acquire();
-        delete Entry;
+        killEntry(Entry);
+        Entry->unref();
     }
-    tableLock.leave();
-    table_rwlock.unlock();
+    shard.tableLock.leave();
+    if (walkers)
+        shard.table_rwlock.unlock();
 
     if (Entry)
         return true;
@@ -127,43 +980,2183 @@ bool Table::del(const char *Name)
         return false;
 }
 
-TableEntry *Table::getFirst(void **cursor)
+/* Finish off an entry unlinkAt()ed to be replaced, once the shard's tableLock
+   is released, but before any table_rwlock for walkers is */
+void Table::discard(Shard &shard, TableEntry *Entry)
 {
-    TableEntry *Entry;
-    table_rwlock.readlock();
-    tableLock.enter();
-    *cursor = table;
-    if (table) {
-        Entry = (TableEntry *) table->val;
+    killEntry(Entry);
+    if (flags & TABLE_EPOCH) {
+        shard.tableLock.enter();
+        bury(shard, Entry);
+        reclaim(shard);
+        shard.tableLock.leave();
     } else {
+        Entry->unref();
+    }
+}
+
+TableEntry *Table::getOrCreate(const char *Name, TableEntryFactory factory, bool *created)
+{
+    if (created)
+        *created = false;
+    if (!Name)
+        return NULL;
+
+    unsigned hash = hashOf(Name);
+    if (__atomic_load_n(&map, __ATOMIC_ACQUIRE))
+        faultIn(Name, hash);
+    Shard &shard = shardOf(hash);
+    //we may need to free an expired entry
+    bool walkers = caching && !(flags & (TABLE_EPOCH | TABLE_SNAPSHOT | TABLE_ORDERED));
+    TableEntry *old = NULL;
+    unsigned long long died = 0;
+    bool made = false;
+
+    if (walkers)
+        shard.table_rwlock.writelock();
+    shard.tableLock.enter();
+    TableEntry **link = shard.findBucket(Name, hash);
+    TableEntry *Entry = link ? *link : NULL;
+    if (Entry && caching && cacheExpiredEntry(Entry)) {
+        old = unlinkAt(shard, link, true, &died);
+        shard.expirations++;
         Entry = NULL;
     }
     if (Entry) {
-        Entry->acquire();
+        acquireEntry(Entry, false);
+        if (caching) {
+            cacheTouch(Entry);
+            __atomic_add_fetch(&shard.hits, 1, __ATOMIC_RELAXED);
+        }
+    } else if ((Entry = factory())) {
+        if (Entry->setName(Name)) {
+            Entry->hash = hash;
+            Entry->acquire();
+            made = insert(shard, Entry, true, died); //see walkStart()
+            if (!made)
+                Entry->release();
+        }
+        if (!made) {
+            Entry->unref();
+            Entry = NULL;
+        } else if (caching) {
+            __atomic_add_fetch(&shard.misses, 1, __ATOMIC_RELAXED);
+            sweep(shard); //not evict() as we hold Entry
+        }
     }
-    tableLock.leave();
-    if (!Entry)
-        table_rwlock.unlock(); //nothing in table => allow writers to table to modify
+    shard.tableLock.leave();
+    if (old)
+        discard(shard, old);
+    if (walkers)
+        shard.table_rwlock.unlock();
+
+    if (created)
+        *created = made;
     return Entry;
 }
 
-TableEntry *Table::getNext(void **cursor)
+bool Table::upsert(TableEntry *Entry, TableMergeFunc merge)
 {
-//Note could do (datanode*)(*cursor)->data.lock.leave();
-//here but no as need explicit release in certain cases anyway.
-    TableEntry *Entry;
-    tableLock.enter();
-    *cursor = ((llist_entry *) *cursor)->next;
+    // Nameless objects CANNOT be part of a table
+    if (!Entry->name)
+        return false;
+
+    Entry->hash = hashOf(Entry->name);
+    if (__atomic_load_n(&map, __ATOMIC_ACQUIRE))
+        faultIn(Entry->name, Entry->hash);
+    Shard &shard = shardOf(Entry->hash);
+    bool walkers = (!merge || caching) && !(flags & (TABLE_EPOCH | TABLE_SNAPSHOT | TABLE_ORDERED));
+    TableEntry *existing = NULL, *old = NULL;
+    unsigned long long died = 0;
+    bool result = true;
+
+    if (walkers)
+        shard.table_rwlock.writelock();
+    shard.tableLock.enter();
+    TableEntry **link = shard.findBucket(Entry->name, Entry->hash);
+    if (link) {
+        bool expired = caching && cacheExpiredEntry(*link);
+        if (merge && !expired) {
+            existing = *link;
+            acquireEntry(existing, false);
+        } else {
+            old = unlinkAt(shard, link, true, &died);
+            if (expired)
+                shard.expirations++;
+        }
+    }
+    if (!existing)
+        result = insert(shard, Entry, true, died); //see walkStart()
+    shard.tableLock.leave();
+    if (old)
+        discard(shard, old);
+    if (walkers)
+        shard.table_rwlock.unlock();
+
+    if (existing) {
+        merge(existing, Entry);
+        updated(existing);
+        existing->release();
+        Entry->unref();
+    } else if (result && caching) {
+        evict(shard);
+    }
+    return result;
+}
+
+static int snapshotCompare(const void *entry1, const void *entry2)
+{
+    return TableEntry::compare(*(TableEntry * const *) entry1, *(TableEntry * const *) entry2);
+}
+
+/* A walk that takes a reference to every entry it sees, marking them as
+   being in a snapshot while it's live, by moving snapshot_at past their
+   versions. O(n) but only a shard's tableLock is held at a time. */
+TableSnapshot *Table::snapshot(void)
+{
+    TableSnapshot *snap = new TableSnapshot;
+    unsigned size = 64;
+    unsigned i;
+
+    faultAll();
+    snap->table = this;
+    snap->count = 0;
+    snap->refs = 1;
+    snap->entries = (TableEntry **) malloc(size * sizeof(TableEntry *));
+    WalkCursor c;
+    walkStart(&c, true);
+    TableEntry *Entry = NULL;
+    while (snap->entries && (Entry = walkStep(&c))) {
+        if (snap->count == size) {
+            TableEntry **bigger = (TableEntry **) realloc(snap->entries, size * 2 * sizeof(TableEntry *));
+            if (!bigger)
+                break;
+            snap->entries = bigger;
+            size *= 2;
+        }
+        Entry->ref();
+        snap->entries[snap->count++] = Entry;
+    }
+    walkEnd(&c);
+    if (!snap->entries || Entry) { //out of memory
+        snap->unref();
+        return NULL;
+    }
+    /* Those holding entries got them before the snapshot, so let them finish.
+       Any later changes must go through getForUpdate() which copies them. */
+    for (i = 0; i < snap->count; i++) {
+        snap->entries[i]->acquireShared();
+        snap->entries[i]->releaseShared();
+    }
+    qsort(snap->entries, snap->count, sizeof(TableEntry *), snapshotCompare);
+    return snap;
+}
+
+TableEntry *TableSnapshot::get(const char *Name) const
+{
+    unsigned lo = 0, hi = count;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        int cmp = TableEntry::findName(entries[mid], Name);
+        if (!cmp)
+            return entries[mid];
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+TableEntry *TableSnapshot::getShared(const char *Name) const
+{
+    TableEntry *Entry = get(Name);
+    if (Entry)
+        Entry->acquireShared();
+    return Entry;
+}
+
+TableEntry *TableSnapshot::atShared(unsigned i) const
+{
+    entries[i]->acquireShared();
+    return entries[i];
+}
+
+void TableSnapshot::unref(void)
+{
+    if (__atomic_sub_fetch(&refs, 1, __ATOMIC_ACQ_REL))
+        return;
+    table->walkLock.enter();
+    if (!--table->live_snapshots)
+        __atomic_store_n(&table->snapshot_at, 0ULL, __ATOMIC_SEQ_CST);
+    table->walkLock.leave();
+    for (unsigned i = 0; i < count; i++)
+        entries[i]->unref();
+    free(entries);
+    delete this;
+}
+
+/* An entry could be in a snapshot if it was added before the latest one was
+   taken, so with a few snapshots on the go some entries may be copied
+   needlessly. If we miss a snapshot() just starting, as for del()s in
+   walkStart(), it gets to the shard after we have the entry, and waits
+   for us to release it. */
+TableEntry *Table::getForUpdate(const char *Name)
+{
+    if (!Name)
+        return NULL;
+
+    unsigned hash = hashOf(Name);
+    if (__atomic_load_n(&map, __ATOMIC_ACQUIRE))
+        faultIn(Name, hash);
+    Shard &shard = shardOf(hash);
+    bool walkers = !(flags & (TABLE_EPOCH | TABLE_SNAPSHOT | TABLE_ORDERED));
+    bool writelocked = false;
+    TableEntry *Entry, *old = NULL;
+
+    for (;;) {
+        if (walkers && !writelocked && __atomic_load_n(&snapshot_at, __ATOMIC_SEQ_CST)) {
+            shard.table_rwlock.writelock();
+            writelocked = true;
+        }
+        shard.tableLock.enter();
+        TableEntry **link = shard.findBucket(Name, hash);
+        Entry = link ? *link : NULL;
+        if (Entry && caching && cacheExpiredEntry(Entry))
+            Entry = NULL; //left for evict() to clear out
+        if (!Entry || nodeOf(Entry)->born > __atomic_load_n(&snapshot_at, __ATOMIC_SEQ_CST)) {
+            if (Entry)
+                acquireEntry(Entry, false);
+            break;
+        }
+        if (walkers && !writelocked) { //a snapshot was taken since we looked
+            shard.tableLock.leave();
+            continue;
+        }
+
+        Entry->acquireShared(); //wait for any change in progress
+        TableEntry *copy = Entry->clone();
+        Entry->releaseShared();
+        if (!copy) {
+            acquireEntry(Entry, false);
+            break;
+        }
+        copy->hash = hash;
+        if (Entry->extra && Entry->extra->expires) {
+            if (!extraOf(copy)) { //out of mem
+                copy->unref();
+                Entry = NULL;
+                break;
+            }
+            copy->extra->expires = Entry->extra->expires;
+        }
+        copy->acquire();
+        unsigned long long died;
+        old = unlinkAt(shard, link, false, &died); //logged as the one update
+        if (insert(shard, copy, false, died)) { //see walkStart()
+            logChange(TABLE_UPDATED, copy);
+        } else {
+            logChange(TABLE_DELETED, old);
+            copy->release();
+            copy->unref();
+            copy = NULL;
+        }
+        Entry = copy;
+        break;
+    }
+    if (caching) {
+        if (Entry) {
+            cacheTouch(Entry);
+            __atomic_add_fetch(&shard.hits, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_add_fetch(&shard.misses, 1, __ATOMIC_RELAXED);
+        }
+    }
+    shard.tableLock.leave();
+    if (old)
+        discard(shard, old);
+    if (writelocked)
+        shard.table_rwlock.unlock();
+
+    return Entry;
+}
+
+/* Items of a batch operation, sorted so that we
+   lock each shard just once, and duplicates are adjacent */
+struct TableBatchItem {
+    unsigned shard;
+    unsigned hash;
+    unsigned index;
+};
+
+static int batchCompare(const void *item1, const void *item2)
+{
+    const TableBatchItem *b1 = (const TableBatchItem *) item1;
+    const TableBatchItem *b2 = (const TableBatchItem *) item2;
+    if (b1->shard != b2->shard)
+        return b1->shard < b2->shard ? -1 : 1;
+    if (b1->hash != b2->hash)
+        return b1->hash < b2->hash ? -1 : 1;
+    return b1->index < b2->index ? -1 : (b1->index > b2->index);
+}
+
+/* NULL names are sorted to the end, with a shard of nshards */
+TableBatchItem *Table::sortBatch(const char * const *Names, unsigned n)
+{
+    TableBatchItem *items = (TableBatchItem *) malloc((n ? n : 1) * sizeof(TableBatchItem));
+    if (!items)
+        return NULL;
+    for (unsigned i = 0; i < n; i++) {
+        items[i].index = i;
+        if (Names[i]) {
+            items[i].hash = hashOf(Names[i]);
+            items[i].shard = shardIndex(items[i].hash);
+        } else {
+            items[i].hash = 0;
+            items[i].shard = nshards;
+        }
+    }
+    qsort(items, n, sizeof(TableBatchItem), batchCompare);
+    return items;
+}
+
+/* Add n Entries taking each shard's lock just once.
+   results[i] (if not NULL) says whether Entries[i] was added,
+   and if not you still own it. Returns the number added. */
+unsigned Table::addMany(TableEntry **Entries, unsigned n, bool *results)
+{
+    unsigned added = 0;
+    unsigned i;
+
+    if (results)
+        for (i = 0; i < n; i++)
+            results[i] = false;
+
+    const char **names = (const char **) calloc(n ? n : 1, sizeof(char *));
+    if (!names)
+        return 0;
+    for (i = 0; i < n; i++)
+        names[i] = Entries[i]->name;
+    TableBatchItem *items = sortBatch(names, n);
+    free(names);
+    if (!items)
+        return 0;
+
+    for (i = 0; i < n && items[i].shard < nshards; ) {
+        Shard &shard = shards[items[i].shard];
+        unsigned end = i;
+        while (end < n && items[end].shard == items[i].shard)
+            end++;
+        shard.tableLock.enter();
+        for (; i < end; i++) {
+            TableEntry *Entry = Entries[items[i].index];
+            Entry->hash = items[i].hash;
+            bool result = insert(shard, Entry);
+            if (results)
+                results[items[i].index] = result;
+            added += result;
+        }
+        shard.tableLock.leave();
+        if (caching)
+            evict(shard);
+    }
+    free(items);
+    return added;
+}
+
+/* get() n Names taking each shard's lock just once.
+   Entries[i] is set to the acquired entry or NULL.
+   Note an entry can't be acquired twice, so if a name
+   is repeated, only its first occurrence is filled in.
+   As with get() be careful of the lock ordering between
+   the returned entries. Returns the number found. */
+unsigned Table::getMany(const char * const *Names, unsigned n, TableEntry **Entries)
+{
+    unsigned found = 0;
+    unsigned long ticket = 0;
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        Entries[i] = NULL;
+    TableBatchItem *items = sortBatch(Names, n);
+    if (!items)
+        return 0;
+
+    if (flags & TABLE_EPOCH)
+        ticket = epoch.enter();
+    for (i = 0; i < n && items[i].shard < nshards; ) {
+        Shard &shard = shards[items[i].shard];
+        unsigned start = i, end = i;
+        while (end < n && items[end].shard == items[i].shard)
+            end++;
+        if (!(flags & TABLE_EPOCH))
+            shard.tableLock.enter();
+        for (; i < end; i++) {
+            const char *Name = Names[items[i].index];
+            TableEntry *Entry;
+            if (flags & TABLE_EPOCH) {
+                Entry = lookup(shard, Name, items[i].hash);
+            } else {
+                TableEntry **link = shard.findBucket(Name, items[i].hash);
+                Entry = link ? *link : NULL;
+            }
+            for (unsigned j = i; Entry && j-- > start && items[j].hash == items[i].hash; )
+                if (!strcmp(Names[items[j].index], Name))
+                    Entry = NULL; //repeated name
+            if (flags & TABLE_EPOCH) {
+                Entry = acquireLive(Entry, false);
+            } else if (Entry) {
+                Entry->acquire();
+            }
+            Entries[items[i].index] = Entry;
+            if (Entry)
+                found++;
+        }
+        if (!(flags & TABLE_EPOCH))
+            shard.tableLock.leave();
+    }
+    if (flags & TABLE_EPOCH)
+        epoch.leave(ticket);
+
+    /* Names not found may be in a load()ed file still */
+    for (i = 0; __atomic_load_n(&map, __ATOMIC_ACQUIRE) && i < n && items[i].shard < nshards; i++) {
+        const char *Name = Names[items[i].index];
+        if (Entries[items[i].index])
+            continue;
+        bool repeated = false;
+        for (unsigned j = i; !repeated && j-- > 0 && items[j].hash == items[i].hash; )
+            repeated = !strcmp(Names[items[j].index], Name);
+        if (!repeated && faultIn(Name, items[i].hash)) {
+            Entries[items[i].index] = findLoaded(Name, items[i].hash, FIND_EXCLUSIVE);
+            if (Entries[items[i].index])
+                found++;
+        }
+    }
+    free(items);
+    return found;
+}
+
+/* del() n Names taking each shard's locks just once.
+   results[i] (if not NULL) says whether Names[i] was deleted.
+   Returns the number deleted. */
+unsigned Table::delMany(const char * const *Names, unsigned n, bool *results)
+{
+    unsigned deleted = 0;
+    unsigned i;
+
+    /* results, or our own array if we need to know what's left to unmapName() */
+    bool *gone = results;
+    bool mapped = __atomic_load_n(&map, __ATOMIC_ACQUIRE) != NULL;
+    if (!gone && mapped &&
+        !(gone = (bool *) malloc((n ? n : 1) * sizeof(bool))))
+        return 0;
+    if (gone)
+        for (i = 0; i < n; i++)
+            gone[i] = false;
+    TableBatchItem *items = sortBatch(Names, n);
+    TableEntry **victims = NULL;
+    if (!items || ((flags & TABLE_EPOCH) &&
+        !(victims = (TableEntry **) malloc((n ? n : 1) * sizeof(TableEntry *))))) {
+        free(items);
+        if (gone != results)
+            free(gone);
+        return 0;
+    }
+
+    bool walkers = !(flags & (TABLE_EPOCH | TABLE_SNAPSHOT | TABLE_ORDERED));
+    for (i = 0; i < n && items[i].shard < nshards; ) {
+        Shard &shard = shards[items[i].shard];
+        unsigned start = i, end = i;
+        while (end < n && items[end].shard == items[i].shard)
+            end++;
+        if (walkers)
+            shard.table_rwlock.writelock();
+        shard.tableLock.enter();
+        for (; i < end; i++) {
+            TableEntry *Entry = unlink(shard, Names[items[i].index], items[i].hash);
+            if (Entry) {
+                if (gone)
+                    gone[items[i].index] = true;
+                deleted++;
+                if (flags & TABLE_EPOCH) {
+                    victims[i] = Entry;
+                    continue;
+                }
+                killEntry(Entry);
+                Entry->unref();
+            } else if (victims) {
+                victims[i] = NULL;
+            }
+        }
+        shard.tableLock.leave();
+        if (walkers)
+            shard.table_rwlock.unlock();
+
+        if (victims) { //as for del(), don't wait on entries with tableLock held
+            for (i = start; i < end; i++)
+                if (victims[i])
+                    killEntry(victims[i]);
+            shard.tableLock.enter();
+            for (i = start; i < end; i++)
+                if (victims[i])
+                    bury(shard, victims[i]);
+            reclaim(shard);
+            shard.tableLock.leave();
+        }
+    }
+    free(victims);
+
+    /* Names not found may be in a load()ed file still, or faulted in since, as for del() */
+    for (i = 0; mapped && i < n && items[i].shard < nshards; i++) {
+        const char *Name = Names[items[i].index];
+        if (!gone[items[i].index] &&
+            (unmapName(Name, items[i].hash) || delLoaded(Name, items[i].hash))) {
+            gone[items[i].index] = true;
+            deleted++;
+        }
+    }
+    if (gone != results)
+        free(gone);
+    free(items);
+    return deleted;
+}
+
+/* Start walking from the first non empty shard >= i.
+   The read lock is held only on the shard we return an entry from. */
+TableEntry *Table::firstFrom(unsigned i, void **cursor, bool shared)
+{
+    for (; i < nshards; i++) {
+        Shard &shard = shards[i];
+        TableEntry *Entry;
+        shard.table_rwlock.readlock();
+        shard.tableLock.enter();
+        llist_entry *node = shard.table;
+        while (node && ((TableNode *) node)->died) //kept for a snapshot()
+            node = node->next;
+        *cursor = node;
+        if (node) {
+            Entry = (TableEntry *) node->val;
+        } else {
+            Entry = NULL;
+        }
+        if (Entry) {
+            acquireEntry(Entry, shared);
+        }
+        shard.tableLock.leave();
+        if (Entry)
+            return Entry;
+        shard.table_rwlock.unlock(); //nothing in shard => allow writers to shard to modify
+    }
+    *cursor = NULL;
+    return NULL;
+}
+
+/* Walk on from node (or the next non empty shard if NULL)
+   to the first entry that hasn't been deleted. */
+TableEntry *Table::epochWalk(void **cursor, llist_entry *node, bool shared)
+{
+    EpochCursor *c = (EpochCursor *) *cursor;
+    for (;;) {
+        while (!node) {
+            if (++c->shard >= nshards) {
+                epoch.leave(c->ticket);
+                free(c);
+                *cursor = NULL;
+                return NULL;
+            }
+            node = __atomic_load_n(&shards[c->shard].table, __ATOMIC_ACQUIRE);
+        }
+        TableEntry *Entry = (TableEntry *) node->val;
+        acquireEntry(Entry, shared);
+        if (Entry->linked()) {
+            c->node = node;
+            return Entry;
+        }
+        releaseEntry(Entry, shared);
+        node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    }
+}
+
+/* Walks and snapshot()s see the table as of a version, bumped as each
+   starts. Entries are stamped with the version when they're added and
+   when they're deleted, so a walk just skips those added after it
+   started, or deleted before. Deleted entries that some walk could see
+   are kept in their shard's list until all such walks are finished,
+   but not in the hash buckets, so get() and del() don't see them.
+
+   So a del() in the middle of a walk's start knows whether to keep the
+   entry, the walk publishes an oldest_walk no later than its version
+   before bumping that, and unlinkAt() reads version then oldest_walk.
+   Either the del() sees the walk, or the walk's version is at least
+   the del()'s and it wouldn't see the entry.
+
+   As walks start without locking the shards, an entry that replaces
+   another is stamped as added when the other was deleted. Else a walk
+   starting in between would see neither of them. */
+void Table::walkStart(WalkCursor *c, bool snapshot)
+{
+    walkLock.enter();
+    unsigned long long v = __atomic_load_n(&version, __ATOMIC_SEQ_CST);
+    if (v < __atomic_load_n(&oldest_walk, __ATOMIC_RELAXED))
+        __atomic_store_n(&oldest_walk, v, __ATOMIC_SEQ_CST);
+    if (snapshot) { //getForUpdate() copies everything while we're getting started
+        live_snapshots++;
+        __atomic_store_n(&snapshot_at, ~0ULL, __ATOMIC_SEQ_CST);
+    }
+    c->at = __atomic_fetch_add(&version, 1, __ATOMIC_SEQ_CST);
+    if (snapshot)
+        __atomic_store_n(&snapshot_at, c->at, __ATOMIC_SEQ_CST);
+    c->shard = 0;
+    c->node = NULL;
+    c->ordered = false;
+    c->next = NULL;
+    c->prev = walks_tail;
+    if (walks_tail)
+        walks_tail->next = c;
+    else
+        walks = c;
+    walks_tail = c;
+    walkLock.leave();
+}
+
+/* Purge any entries kept just for this walk */
+void Table::walkEnd(WalkCursor *c)
+{
+    walkLock.enter();
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        walks = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+    else
+        walks_tail = c->prev;
+    __atomic_store_n(&oldest_walk, walks ? walks->at : ~0ULL, __ATOMIC_SEQ_CST);
+    walkLock.leave();
+
+    for (unsigned i = 0; i < nshards; i++) {
+        Shard &shard = shards[i];
+        if (!__atomic_load_n(&shard.kept, __ATOMIC_ACQUIRE))
+            continue;
+        shard.tableLock.enter();
+        TableNode *gone = purge(shard);
+        if (flags & TABLE_EPOCH)
+            reclaim(shard);
+        shard.tableLock.leave();
+        while (gone) {
+            TableNode *node = gone;
+            TableEntry *Entry = (TableEntry *) node->list.val;
+            gone = node->kept_next;
+            freeNode(node);
+            Entry->unref();
+        }
+    }
+}
+
+static inline bool visibleAt(const TableEntry *Entry, unsigned long long at)
+{
+    const TableNode *node = nodeOf(Entry);
+    return node->born <= at && (!node->died || node->died > at);
+}
+
+/* Step to the next entry the walk sees, or NULL at the end. The entry is
+   neither held nor ref()d, but it's kept in the table until walkEnd(). */
+TableEntry *Table::walkStep(WalkCursor *c)
+{
+    for (; c->shard < nshards; c->shard++, c->node = NULL) {
+        Shard &shard = shards[c->shard];
+        shard.tableLock.enter();
+        llist_entry *node = c->node ? c->node->next : shard.table;
+        while (node && !visibleAt((TableEntry *) node->val, c->at))
+            node = node->next;
+        shard.tableLock.leave();
+        if (node) {
+            c->node = node;
+            return (TableEntry *) node->val;
+        }
+    }
+    return NULL;
+}
+
+/* Snapshot cursors are tagged in the low bit, so that getNext()
+   can tell them from other cursors in tables that mostly don't use
+   them, as secondary index queries return them whatever the flags. */
+static inline bool isSnapshot(void *cursor)
+{
+    return ((uintptr_t) cursor & 1);
+}
+
+/* and WalkCursors in the next bit */
+static inline bool isWalk(void *cursor)
+{
+    return ((uintptr_t) cursor & 2);
+}
+
+/* The first node from here on that the walk sees. Must hold tableLock */
+static skiplist_node *orderSkip(skiplist_node *node, unsigned long long at)
+{
+    while (node && !visibleAt((TableEntry *) node->val, at))
+        node = skiplist_next(node);
+    return node;
+}
+
+/* Step to the least of the shards' next entries, moving past it in its
+   shard, or NULL at the end. The heads stay in the indexes while the walk
+   can see them, as deleted ones are kept until walkEnd() like any other. */
+TableEntry *Table::orderStep(OrderCursor *c)
+{
+    unsigned least = nshards;
+    for (unsigned i = 0; i < nshards; i++)
+        if (c->heads[i] && (least == nshards ||
+                            orderCompare(c->heads[i]->val, c->heads[least]->val) < 0))
+            least = i;
+    if (least == nshards)
+        return NULL;
+    TableEntry *Entry = (TableEntry *) c->heads[least]->val;
+    if (c->hi && TableEntry::findName(Entry, c->hi) >= 0)
+        return NULL;
+    Shard &shard = shards[least];
+    shard.tableLock.enter();
+    c->heads[least] = orderSkip(skiplist_next(c->heads[least]), c->walk.at);
+    shard.tableLock.leave();
+    return Entry;
+}
+
+/* End the walk and free its cursor */
+void Table::walkFree(WalkCursor *c)
+{
+    walkEnd(c);
+    if (c->ordered)
+        free(((OrderCursor *) c)->hi);
+    free(c);
+}
+
+/* Return the walk's next entry, ending it at the last */
+TableEntry *Table::versionStep(void **cursor, WalkCursor *c, bool shared)
+{
+    TableEntry *Entry = c->ordered ? orderStep((OrderCursor *) c) : walkStep(c);
+    if (!Entry) {
+        walkFree(c);
+        *cursor = NULL;
+        return NULL;
+    }
+    *cursor = (void *) ((uintptr_t) c | 2);
+    acquireEntry(Entry, shared);
+    return Entry;
+}
+
+/* Return the first entry of the snapshot, or NULL if it's empty */
+TableEntry *Table::snapshotStart(void **cursor, SnapshotCursor *c, bool shared)
+{
+    *cursor = NULL;
+    if (c && !c->count) {
+        free(c);
+        c = NULL;
+    }
+    if (!c)
+        return NULL;
+    *cursor = (void *) ((uintptr_t) c | 1);
+    acquireEntry(c->entries[0], shared);
+    return c->entries[0];
+}
+
+/* ref() and append Entry, doubling the size of the cursor as needed */
+bool Table::snapshotPush(SnapshotCursor **c, unsigned *size, TableEntry *Entry)
+{
+    if ((*c)->count == *size) {
+        SnapshotCursor *bigger = (SnapshotCursor *)
+            realloc(*c, sizeof(SnapshotCursor) + (*size * 2 - 1) * sizeof(TableEntry *));
+        if (!bigger)
+            return false;
+        *c = bigger;
+        *size *= 2;
+    }
+    Entry->ref();
+    (*c)->entries[(*c)->count++] = Entry;
+    return true;
+}
+
+/* Walk the entries with lo <= name < hi, where NULL means unbounded,
+   merging the shards' ordered indexes as we go, so nothing is copied and
+   no lock is held for long. O(s log n) to start, then O(s) an entry */
+TableEntry *Table::getFirstInRange(void **cursor, const char *lo, const char *hi, bool shared)
+{
+    *cursor = NULL;
+    if (!(flags & TABLE_ORDERED))
+        return NULL;
+    faultAll();
+
+    OrderCursor *c = (OrderCursor *) malloc(sizeof(OrderCursor) + (nshards - 1) * sizeof(skiplist_node *));
+    if (!c)
+        return NULL;
+    c->hi = NULL;
+    if (hi && !(c->hi = strdup(hi))) {
+        free(c);
+        return NULL;
+    }
+    walkStart(&c->walk, false);
+    c->walk.ordered = true;
+    for (unsigned i = 0; i < nshards; i++) {
+        Shard &shard = shards[i];
+        shard.tableLock.enter();
+        skiplist_node *node = lo ? skiplist_seek(shard.order, lo, TableEntry::findName)
+                                 : skiplist_first(shard.order);
+        c->heads[i] = orderSkip(node, c->walk.at);
+        shard.tableLock.leave();
+    }
+    return versionStep(cursor, &c->walk, shared);
+}
+
+TableEntry *Table::getFirstWithPrefix(void **cursor, const char *prefix, bool shared)
+{
+    /* names starting with prefix are < prefix with its last
+       incrementable char incremented, and the rest dropped */
+    size_t len = strlen(prefix);
+    char *hi = strdup(prefix);
+    if (!hi) {
+        *cursor = NULL;
+        return NULL;
+    }
+    while (len && (unsigned char) hi[len - 1] == 0xFF)
+        len--;
+    hi[len] = '\0';
+    if (len)
+        hi[len - 1]++;
+
+    TableEntry *Entry = getFirstInRange(cursor, prefix, len ? hi : NULL, shared);
+    free(hi);
+    return Entry;
+}
+
+TableEntry *Table::snapshotNext(void **cursor, bool shared)
+{
+    SnapshotCursor *c = (SnapshotCursor *) ((uintptr_t) *cursor & ~(uintptr_t) 1);
+    c->entries[c->pos++]->unref();
+    if (c->pos == c->count) {
+        free(c);
+        *cursor = NULL;
+        return NULL;
+    }
+    acquireEntry(c->entries[c->pos], shared);
+    return c->entries[c->pos];
+}
+
+TableEntry *Table::first(void **cursor, bool shared)
+{
+    faultAll(); //walks see load()ed entries too
+    if (flags & TABLE_ORDERED)
+        return getFirstInRange(cursor, NULL, NULL, shared);
+    if (flags & TABLE_SNAPSHOT) {
+        WalkCursor *c = (WalkCursor *) malloc(sizeof(WalkCursor));
+        *cursor = NULL;
+        if (!c)
+            return NULL;
+        walkStart(c, false);
+        return versionStep(cursor, c, shared);
+    }
+    if (flags & TABLE_EPOCH) {
+        EpochCursor *c = (EpochCursor *) malloc(sizeof(EpochCursor));
+        if (!c) {
+            *cursor = NULL;
+            return NULL;
+        }
+        c->ticket = epoch.enter();
+        c->shard = 0;
+        *cursor = c;
+        return epochWalk(cursor, __atomic_load_n(&shards[0].table, __ATOMIC_ACQUIRE), shared);
+    }
+    return firstFrom(0, cursor, shared);
+}
+
+TableEntry *Table::next(void **cursor, bool shared)
+{
+    if (isSnapshot(*cursor))
+        return snapshotNext(cursor, shared);
+    if (isWalk(*cursor))
+        return versionStep(cursor, (WalkCursor *) ((uintptr_t) *cursor & ~(uintptr_t) 2), shared);
+    if (flags & TABLE_EPOCH) {
+        EpochCursor *c = (EpochCursor *) *cursor;
+        return epochWalk(cursor, __atomic_load_n(&c->node->next, __ATOMIC_ACQUIRE), shared);
+    }
+
+//Note could do (datanode*)(*cursor)->data.lock.leave();
+//here but no as need explicit release in certain cases anyway.
+    TableEntry *Entry;
+    unsigned i = shardIndex(((TableEntry *) ((llist_entry *) *cursor)->val)->hash);
+    Shard &shard = shards[i];
+    shard.tableLock.enter();
+    llist_entry *node = ((llist_entry *) *cursor)->next;
+    while (node && ((TableNode *) node)->died)
+        node = node->next;
+    *cursor = node;
     if (*cursor) {
         Entry = (TableEntry *) ((llist_entry *) *cursor)->val;
     } else {
         Entry = NULL;
     }
     if (Entry) {
-        Entry->acquire();
+        acquireEntry(Entry, shared);
+    }
+    shard.tableLock.leave();
+    if (!Entry) {
+        shard.table_rwlock.unlock(); //@ end of shard => allow writers to shard to modify
+        return firstFrom(i + 1, cursor, shared);
     }
-    tableLock.leave();
-    if (!Entry)
-        table_rwlock.unlock(); //@ end of table => allow writers to table to modify
     return Entry;
 }
+
+TableEntry *Table::getFirst(void **cursor)
+{
+    return first(cursor, false);
+}
+
+TableEntry *Table::getNext(void **cursor)
+{
+    return next(cursor, false);
+}
+
+TableEntry *Table::getFirstShared(void **cursor)
+{
+    return first(cursor, true);
+}
+
+TableEntry *Table::getNextShared(void **cursor)
+{
+    return next(cursor, true);
+}
+
+void Table::abortWalk(void **cursor)
+{
+    if (isSnapshot(*cursor)) {
+        SnapshotCursor *c = (SnapshotCursor *) ((uintptr_t) *cursor & ~(uintptr_t) 1);
+        while (c->pos < c->count)
+            c->entries[c->pos++]->unref();
+        free(c);
+        *cursor = NULL;
+        return;
+    }
+    if (isWalk(*cursor)) {
+        walkFree((WalkCursor *) ((uintptr_t) *cursor & ~(uintptr_t) 2));
+        *cursor = NULL;
+        return;
+    }
+    if (flags & TABLE_EPOCH) {
+        EpochCursor *c = (EpochCursor *) *cursor;
+        epoch.leave(c->ticket);
+        free(c);
+        *cursor = NULL;
+        return;
+    }
+    TableEntry *Entry = (TableEntry *) ((llist_entry *) *cursor)->val;
+    shardOf(Entry->hash).table_rwlock.unlock();
+}
+
+void Table::resumeWalk(void **cursor)
+{
+    if ((flags & (TABLE_EPOCH | TABLE_SNAPSHOT | TABLE_ORDERED)) || isSnapshot(*cursor) || isWalk(*cursor))
+        return; //del() doesn't wait for these walks
+    TableEntry *Entry = (TableEntry *) ((llist_entry *) *cursor)->val;
+    shardOf(Entry->hash).table_rwlock.readlock();
+}
+
+#define TABLE_FOREACH_CHUNK 64 /* entries a thread takes at a time */
+
+/* Threads pull chunks of the walk until it's done,
+   so that threads with fast callbacks do more of the work */
+struct TableForEachJob {
+    Table *table;
+    Table::WalkCursor walk;
+    CriticalSection lock;   /* for walk */
+    TableEntryFunc fn;
+    void *arg;
+    bool shared;
+
+    void run(void) {
+        TableEntry *chunk[TABLE_FOREACH_CHUNK];
+        for (;;) {
+            unsigned n = 0;
+            lock.enter();
+            while (n < TABLE_FOREACH_CHUNK && (chunk[n] = table->walkStep(&walk)))
+                n++;
+            lock.leave();
+            if (!n)
+                return;
+            for (unsigned i = 0; i < n; i++) { //kept till the walk ends
+                TableEntry *Entry = chunk[i];
+                acquireEntry(Entry, shared);
+                if (Entry->linked())
+                    fn(Entry, arg);
+                releaseEntry(Entry, shared);
+            }
+        }
+    }
+};
+
+class TableForEachThread: public Thread
+{
+public:
+    TableForEachJob *job;
+private:
+    void main(void) { job->run(); }
+};
+
+void Table::forEachParallel(TableEntryFunc fn, void *arg, unsigned nthreads, bool shared)
+{
+    faultAll();
+    TableForEachJob job;
+    job.table = this;
+    job.fn = fn;
+    job.arg = arg;
+    job.shared = shared;
+
+    unsigned count = 0;
+    for (unsigned i = 0; i < nshards; i++) {
+        shards[i].tableLock.enter();
+        count += shards[i].count;
+        shards[i].tableLock.leave();
+    }
+    unsigned chunks = (count + TABLE_FOREACH_CHUNK - 1) / TABLE_FOREACH_CHUNK;
+    if (nthreads > chunks)
+        nthreads = chunks;
+    walkStart(&job.walk, false);
+    TableForEachThread *threads = NULL;
+    if (nthreads > 1)
+        threads = new TableForEachThread[nthreads - 1];
+    for (unsigned i = 0; threads && i < nthreads - 1; i++) {
+        threads[i].job = &job;
+        threads[i].StartThread(false); //if this fails the others take up the slack
+    }
+    job.run();
+    for (unsigned i = 0; threads && i < nthreads - 1; i++)
+        threads[i].WaitThread();
+    delete[] threads;
+    walkEnd(&job.walk);
+}
+
+void Table::lockReport(FILE *out, unsigned top)
+{
+#ifdef LOCK_PROFILE
+    tableLockStats.print(out, "tableLock");
+    rwlockStats.print(out, "table_rwlock");
+    TableEntry::lockStats.print(out, "entries (all tables)");
+
+    /* Keep the top entries by wait time, in descending order.
+       They're kept in the table until the walk ends. */
+    TableEntry **hot = top ? (TableEntry **) malloc(top * sizeof(TableEntry *)) : NULL;
+    unsigned nhot = 0;
+    WalkCursor c;
+    walkStart(&c, false);
+    TableEntry *Entry;
+    while (hot && (Entry = walkStep(&c))) {
+        unsigned long long wait = __atomic_load_n(&Entry->lock_wait_ns, __ATOMIC_RELAXED);
+        if (!wait || (nhot == top && wait <= hot[top - 1]->lock_wait_ns))
+            continue;
+        if (nhot == top)
+            nhot--;
+        unsigned j = nhot++;
+        for (; j && hot[j - 1]->lock_wait_ns < wait; j--)
+            hot[j] = hot[j - 1];
+        hot[j] = Entry;
+    }
+    if (nhot)
+        fprintf(out, "hottest entries:\n");
+    for (unsigned i = 0; i < nhot; i++) {
+        Entry = hot[i];
+        Entry->acquireShared(); //for the name
+        fprintf(out, "  %-32s %10u acquires %10u contended %14llu ns waiting\n",
+                Entry->name, Entry->lock_acquires, Entry->lock_contended, Entry->lock_wait_ns);
+        Entry->releaseShared();
+    }
+    walkEnd(&c);
+    free(hot);
+#else
+    (void) top;
+    fprintf(out, "lock profiling not built in, see LOCK_PROFILE in PadThreads.h\n");
+#endif
+}
+
+/* Secondary indexes keep the entries themselves in a skip list, ordered by
+   the key in Entry->extra->index_keys[index], then by address. So each index needs
+   its own comparison functions, which we generate for every index number. */
+template <unsigned I> static int indexCompare(const void *entry1, const void *entry2)
+{
+    const TableEntry *e1 = (const TableEntry *) entry1;
+    const TableEntry *e2 = (const TableEntry *) entry2;
+    const long long *k1 = e1->extra->index_keys, *k2 = e2->extra->index_keys;
+    if (k1[I] != k2[I])
+        return k1[I] < k2[I] ? -1 : 1;
+    return e1 < e2 ? -1 : (e1 > e2);
+}
+
+template <unsigned I> static int indexSeek(const void *entry, const void *key)
+{
+    long long k = *(const long long *) key;
+    const long long *keys = ((const TableEntry *) entry)->extra->index_keys;
+    return keys[I] < k ? -1 : (keys[I] > k);
+}
+
+static const llist_cmp_func indexCompares[TABLE_MAX_INDEXES] = {
+    indexCompare<0>, indexCompare<1>, indexCompare<2>, indexCompare<3>,
+    indexCompare<4>, indexCompare<5>, indexCompare<6>, indexCompare<7>
+};
+static const llist_cmp_func indexSeeks[TABLE_MAX_INDEXES] = {
+    indexSeek<0>, indexSeek<1>, indexSeek<2>, indexSeek<3>,
+    indexSeek<4>, indexSeek<5>, indexSeek<6>, indexSeek<7>
+};
+
+/* Extract Entry's keys and add it to every index. Must hold tableLock,
+   and Entry must have its extra bookkeeping. */
+bool Table::indexAdd(TableEntry *Entry)
+{
+    long long *keys = (long long *) malloc(nindexes * sizeof(long long));
+    if (!keys)
+        return false;
+    for (unsigned i = 0; i < nindexes; i++)
+        keys[i] = indexes[i].key(Entry);
+
+    unsigned i;
+    indexLock.enter();
+    Entry->extra->index_keys = keys;
+    for (i = 0; i < nindexes; i++)
+        if (!skiplist_add(indexes[i].list, Entry))
+            break;
+    if (i < nindexes) { //out of mem
+        while (i--)
+            skiplist_pop(indexes[i].list, Entry);
+        Entry->extra->index_keys = NULL;
+    }
+    indexLock.leave();
+
+    if (i < nindexes) {
+        free(keys);
+        return false;
+    }
+    return true;
+}
+
+/* Must hold tableLock */
+void Table::indexDel(TableEntry *Entry)
+{
+    if (!Entry->extra || !Entry->extra->index_keys)
+        return;
+    indexLock.enter();
+    for (unsigned i = 0; i < nindexes; i++)
+        skiplist_pop(indexes[i].list, Entry);
+    long long *keys = Entry->extra->index_keys;
+    Entry->extra->index_keys = NULL;
+    indexLock.leave();
+    free(keys);
+}
+
+/* All shards are locked, so that no entry is added without this index */
+int Table::addIndex(TableKeyFunc key)
+{
+    int index = -1;
+    unsigned i;
+
+    faultAll();
+    for (i = 0; i < nshards; i++)
+        shards[i].tableLock.enter();
+    indexLock.enter();
+    skiplist *list = NULL;
+    if (nindexes < TABLE_MAX_INDEXES)
+        list = skiplist_new(indexCompares[nindexes]);
+    bool ok = list != NULL;
+    for (i = 0; ok && i < nshards; i++) {
+        for (llist_entry *node = shards[i].table; ok && node; node = node->next) {
+            TableEntry *Entry = (TableEntry *) node->val;
+            if (((TableNode *) node)->died) //only there for walks
+                continue;
+            long long *keys = NULL;
+            if (extraOf(Entry))
+                keys = (long long *) realloc(Entry->extra->index_keys, (nindexes + 1) * sizeof(long long));
+            if (!keys) {
+                ok = false;
+                break;
+            }
+            Entry->extra->index_keys = keys;
+            keys[nindexes] = key(Entry);
+            ok = skiplist_add(list, Entry);
+        }
+    }
+    if (ok) {
+        indexes[nindexes].key = key;
+        indexes[nindexes].list = list;
+        index = nindexes++;
+    } else if (list) {
+        skiplist_delete(list); //any bigger index_keys are harmless
+    }
+    indexLock.leave();
+    for (i = 0; i < nshards; i++)
+        shards[i].tableLock.leave();
+    return index;
+}
+
+/* The caller holds Entry, so we mustn't take tableLock as get() holds that
+   while waiting for entries. Instead index_keys is only set or cleared
+   with indexLock held, and extra is set before index_keys. */
+bool Table::reindex(TableEntry *Entry)
+{
+    bool ok = true;
+
+    indexLock.enter();
+    long long *keys = Entry->extra ? Entry->extra->index_keys : NULL;
+    if (!keys) { //not in the table (any more)
+        indexLock.leave();
+        return false;
+    }
+    for (unsigned i = 0; i < nindexes; i++) {
+        long long key = indexes[i].key(Entry);
+        if (key == keys[i])
+            continue;
+        skiplist_pop(indexes[i].list, Entry);
+        keys[i] = key;
+        if (!skiplist_add(indexes[i].list, Entry))
+            ok = false; //out of mem, so missing from this index
+    }
+    indexLock.leave();
+    return ok;
+}
+
+/* Snapshot the entries from the index with lo <= key <= hi. O(log n + k) */
+TableEntry *Table::getFirstByKey(void **cursor, int index, long long lo, long long hi, bool shared)
+{
+    SnapshotCursor *c = NULL;
+    unsigned size = 16;
+
+    *cursor = NULL;
+    faultAll();
+    indexLock.enter();
+    if (index >= 0 && (unsigned) index < nindexes)
+        c = (SnapshotCursor *) malloc(sizeof(SnapshotCursor) + (size - 1) * sizeof(TableEntry *));
+    if (c) {
+        c->count = 0;
+        c->pos = 0;
+        skiplist_node *node = skiplist_seek(indexes[index].list, &lo, indexSeeks[index]);
+        for (; node; node = skiplist_next(node)) {
+            TableEntry *Entry = (TableEntry *) node->val;
+            if (Entry->extra->index_keys[index] > hi)
+                break;
+            if (!snapshotPush(&c, &size, Entry))
+                break; //return what we have
+        }
+    }
+    indexLock.leave();
+
+    return snapshotStart(cursor, c, shared);
+}
+
+/* The change log is a ring of the last nchanges changes, each holding a
+   reference to its entry. Changes are logged under the shard's tableLock,
+   so they're in the order they were made to each entry. */
+bool Table::logChanges(unsigned capacity)
+{
+    unsigned size = 1;
+    while (size < capacity)
+        size *= 2;
+    TableChange *ring = (TableChange *) calloc(size, sizeof(TableChange));
+    if (!ring)
+        return false;
+
+    changeLock.enter();
+    TableChange *old = changes;
+    unsigned nold = nchanges;
+    if (!old)
+        change_oldest = change_seq + 1;
+    else if (change_seq - change_oldest >= size) //keep what still fits
+        change_oldest = change_seq - size + 1;
+    for (unsigned long long seq = change_oldest; old && seq <= change_seq; seq++) {
+        ring[seq & (size - 1)] = old[seq & (nold - 1)];
+        old[seq & (nold - 1)].Entry = NULL;
+    }
+    __atomic_store_n(&changes, ring, __ATOMIC_RELEASE);
+    nchanges = size;
+    changeLock.leave();
+
+    for (unsigned i = 0; i < nold; i++)
+        if (old[i].Entry)
+            old[i].Entry->unref();
+    free(old);
+    return true;
+}
+
+/* Must hold the entry's shard tableLock, or for updates the entry itself.
+   unlinkAt() clears linked before logging the delete, so if an update
+   sees it set here, the update is logged first. */
+void Table::logChange(int type, TableEntry *Entry)
+{
+    if (!__atomic_load_n(&changes, __ATOMIC_ACQUIRE))
+        return;
+    changeLock.enter();
+    if (type == TABLE_UPDATED && !Entry->linked()) {
+        changeLock.leave();
+        return; //del()eted
+    }
+    TableChange &change = changes[++change_seq & (nchanges - 1)];
+    TableEntry *old = change.Entry;
+    change.seq = change_seq;
+    change.type = type;
+    change.Entry = Entry;
+    Entry->ref();
+    if (change_seq - change_oldest >= nchanges)
+        change_oldest++;
+    changeLock.leave();
+    if (old)
+        old->unref(); //may free an entry deleted since
+}
+
+unsigned long long Table::changeSeq(void)
+{
+    changeLock.enter();
+    unsigned long long seq = change_seq;
+    changeLock.leave();
+    return seq;
+}
+
+int Table::changesSince(unsigned long long since, TableChange *out, unsigned max)
+{
+    int n = 0;
+
+    changeLock.enter();
+    if (!changes || since + 1 < change_oldest) {
+        changeLock.leave();
+        return -1; //not logging, or since has been overwritten
+    }
+    for (unsigned long long seq = since + 1; seq <= change_seq && (unsigned) n < max; seq++) {
+        out[n] = changes[seq & (nchanges - 1)];
+        out[n++].Entry->ref();
+    }
+    changeLock.leave();
+    return n;
+}
+
+/* As for reindex() we can't take tableLock, see logChange() */
+bool Table::updated(TableEntry *Entry)
+{
+    bool ok = reindex(Entry) || !nindexes;
+    logChange(TABLE_UPDATED, Entry);
+    return ok && Entry->linked();
+}
+
+#define TABLE_EVICT_BATCH 8   /* most entries evicted per add() */
+#define TABLE_EVICT_SCAN  64  /* most buckets the clock hand passes per add() when full */
+#define TABLE_EXPIRE_SCAN 2   /* and when just looking for expired entries */
+#define TABLE_EVICT_SLACK 8   /* 1/8 over its limits, a shard waits for walks to evict */
+
+void Table::setCache(unsigned max_entries, size_t max_bytes, unsigned ttl)
+{
+    cache_max_entries = max_entries ? (max_entries + nshards - 1) / nshards : 0;
+    cache_max_bytes = max_bytes ? (max_bytes + nshards - 1) / nshards : 0;
+    cache_ttl = ttl;
+    caching = true;
+}
+
+void Table::getCacheStats(TableCacheStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (unsigned i = 0; i < nshards; i++) {
+        Shard &shard = shards[i];
+        stats->hits += __atomic_load_n(&shard.hits, __ATOMIC_RELAXED);
+        stats->misses += __atomic_load_n(&shard.misses, __ATOMIC_RELAXED);
+        shard.tableLock.enter();
+        stats->evictions += shard.evictions;
+        stats->expirations += shard.expirations;
+        stats->entries += shard.count;
+        stats->bytes += shard.bytes;
+        shard.tableLock.leave();
+    }
+}
+
+#define TABLE_FILTER_PER_ENTRY 8   /* counters */
+#define TABLE_FILTER_HASHES    4   /* counters per name */
+
+/* The counters for a name are picked by double hashing its hash, mixed
+   (as in murmur3) since shardIndex() and the buckets use bits of it.
+   Counters stick at 255 so they're never decremented below the
+   number of names using them. */
+static inline unsigned filterMix(unsigned h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+static void filterBump(unsigned char *f, unsigned size, unsigned hash, bool add)
+{
+    unsigned h1 = filterMix(hash), h2 = filterMix(hash ^ 0x9e3779b9U) | 1;
+    for (unsigned i = 0; i < TABLE_FILTER_HASHES; i++) {
+        unsigned char *counter = &f[(h1 + i * h2) & (size - 1)];
+        unsigned char c = __atomic_load_n(counter, __ATOMIC_RELAXED);
+        while (c != 255 && !__atomic_compare_exchange_n(counter, &c, add ? c + 1 : c - 1, true,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+    }
+}
+
+/* Count a name in or out of the filter. Must hold the tableLock
+   of the name's shard, or mapLock for names in the mapped file. */
+void Table::filterCount(unsigned hash, bool add)
+{
+    unsigned char *f = __atomic_load_n(&filter, __ATOMIC_ACQUIRE);
+    if (f)
+        filterBump(f, filter_size, hash, add);
+}
+
+/* Whether the name with hash might be in the table, without any locks.
+   Always true if there's no filter. */
+bool Table::filterMaybe(Shard &shard, unsigned hash)
+{
+    unsigned char *f = __atomic_load_n(&filter, __ATOMIC_ACQUIRE);
+    if (!f)
+        return true;
+    __atomic_add_fetch(&shard.filter_lookups, 1, __ATOMIC_RELAXED);
+    unsigned h1 = filterMix(hash), h2 = filterMix(hash ^ 0x9e3779b9U) | 1;
+    for (unsigned i = 0; i < TABLE_FILTER_HASHES; i++) {
+        if (!__atomic_load_n(&f[(h1 + i * h2) & (filter_size - 1)], __ATOMIC_RELAXED)) {
+            __atomic_add_fetch(&shard.filter_negatives, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* A CLOCK sweep of a few buckets, removing expired entries, and entries
+   not looked up since the hand last passed if the shard is over its limits.
+   Entries that someone holds are skipped, so we never wait on them with
+   tableLock held. If a walk is in the shard we leave it till later, unless
+   walks keep coming and the shard is TABLE_EVICT_SLACK over its limits, in
+   which case we wait for them as del() does. */
+void Table::evict(Shard &shard)
+{
+    bool walkers = !(flags & (TABLE_EPOCH | TABLE_SNAPSHOT | TABLE_ORDERED));
+    if (walkers && !shard.table_rwlock.trywritelock()) {
+        shard.tableLock.enter();
+        bool over = (cache_max_entries && shard.count > cache_max_entries + cache_max_entries / TABLE_EVICT_SLACK) ||
+                    (cache_max_bytes && shard.bytes > cache_max_bytes + cache_max_bytes / TABLE_EVICT_SLACK);
+        shard.tableLock.leave();
+        if (!over)
+            return;
+        shard.table_rwlock.writelock();
+    }
+    shard.tableLock.enter();
+    sweep(shard);
+    shard.tableLock.leave();
+    if (walkers)
+        shard.table_rwlock.unlock();
+}
+
+/* The above with tableLock held, and the table_rwlock if there are walkers */
+void Table::sweep(Shard &shard)
+{
+    unsigned now = cacheNow();
+    unsigned evicted = 0;
+    bool full = (cache_max_entries && shard.count > cache_max_entries) ||
+                (cache_max_bytes && shard.bytes > cache_max_bytes);
+    unsigned scan = full ? TABLE_EVICT_SCAN : (cache_ttl ? TABLE_EXPIRE_SCAN : 0);
+    for (unsigned i = 0; i < scan && shard.nbuckets && evicted < TABLE_EVICT_BATCH; i++) {
+        TableEntry **link = &shard.buckets[shard.hand++ & (shard.nbuckets - 1)];
+        while (*link && evicted < TABLE_EVICT_BATCH) {
+            TableEntry *Entry = *link;
+            TableEntryExtra *extra = Entry->extra;
+            bool expired = extra->expires && cacheExpired(extra->expires, now);
+            if (!expired && (!full || __atomic_load_n(&extra->referenced, __ATOMIC_RELAXED))) {
+                if (full)
+                    __atomic_store_n(&extra->referenced, false, __ATOMIC_RELAXED);
+                link = &Entry->hash_next;
+                continue;
+            }
+            if (!Entry->tryAcquire()) { //in use
+                link = &Entry->hash_next;
+                continue;
+            }
+            unlinkAt(shard, link);
+            Entry->release();
+            if (flags & TABLE_EPOCH)
+                bury(shard, Entry);
+            else
+                Entry->unref();
+            evicted++;
+            if (expired)
+                shard.expirations++;
+            else
+                shard.evictions++;
+            full = (cache_max_entries && shard.count > cache_max_entries) ||
+                   (cache_max_bytes && shard.bytes > cache_max_bytes);
+        }
+    }
+    if (evicted && (flags & TABLE_EPOCH))
+        reclaim(shard);
+}
+
+/* addLines() works in 3 passes, each spread over the threads:
+     populate() the entries from each chunk of lines
+     scatter them into one array grouped by shard, keeping the line order
+     drop the duplicates in each shard's group and insert the rest
+   so the only serial work is summing the per chunk, per shard counts. */
+
+#define TABLE_LOAD_CHUNK (1 << 20) /* most bytes of lines a thread takes at a time */
+#define TABLE_LOAD_BATCH 1024      /* entries inserted per hold of tableLock */
+
+struct TableLoadItem {
+    TableEntry *Entry;
+    unsigned line;      /* order in the input */
+};
+
+struct TableLoadChunk {
+    char *start;
+    char *end;          /* just after a '\n', or where we can put one */
+    TableEntry **entries;
+    unsigned count;
+    unsigned size;
+};
+
+/* Same names are adjacent with the last line last */
+static int loadCompare(const void *item1, const void *item2)
+{
+    const TableLoadItem *l1 = (const TableLoadItem *) item1;
+    const TableLoadItem *l2 = (const TableLoadItem *) item2;
+    if (l1->Entry->hash != l2->Entry->hash)
+        return l1->Entry->hash < l2->Entry->hash ? -1 : 1;
+    int cmp = strcmp(l1->Entry->name, l2->Entry->name);
+    if (cmp)
+        return cmp;
+    return l1->line < l2->line ? -1 : (l1->line > l2->line);
+}
+
+struct TableLoadJob {
+    enum Pass { POPULATE, SCATTER, INSERT } pass;
+    Table *table;
+    TableEntryFactory factory;
+    TableLoadChunk *chunks;
+    unsigned nchunks;
+    unsigned *counts;       /* [chunk][shard] counts, then offsets into items */
+    unsigned *starts;       /* [shard] offsets into items, and the total */
+    TableLoadItem *items;
+    unsigned next;
+    unsigned added;
+
+    void populate(unsigned c) {
+        TableLoadChunk &chunk = chunks[c];
+        unsigned *count = counts + c * table->nshards;
+        for (char *line = chunk.start; line < chunk.end; ) {
+            char *eol = (char *) memchr(line, '\n', chunk.end - line);
+            if (!eol)
+                eol = chunk.end;
+            *eol = '\0';
+            TableEntry *Entry = line < eol ? factory() : NULL;
+            if (Entry && (!Entry->populate(line) || !Entry->name)) {
+                delete Entry;
+                Entry = NULL;
+            }
+            line = eol + 1;
+            if (!Entry)
+                continue;
+            if (chunk.count == chunk.size) {
+                unsigned size = chunk.size ? chunk.size * 2 : 256;
+                TableEntry **bigger = (TableEntry **) realloc(chunk.entries, size * sizeof(TableEntry *));
+                if (!bigger) {
+                    delete Entry;
+                    continue;
+                }
+                chunk.entries = bigger;
+                chunk.size = size;
+            }
+            Entry->hash = table->hashOf(Entry->name);
+            count[table->shardIndex(Entry->hash)]++;
+            chunk.entries[chunk.count++] = Entry;
+        }
+    }
+    void scatter(unsigned c) {
+        TableLoadChunk &chunk = chunks[c];
+        unsigned *offset = counts + c * table->nshards;
+        for (unsigned i = 0; i < chunk.count; i++) {
+            unsigned line = offset[table->shardIndex(chunk.entries[i]->hash)]++;
+            items[line].Entry = chunk.entries[i];
+            items[line].line = line;
+        }
+        free(chunk.entries);
+        chunk.entries = NULL;
+    }
+    void run(void) {
+        unsigned n = pass == INSERT ? table->nshards : nchunks;
+        for (;;) {
+            unsigned i = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED);
+            if (i >= n)
+                return;
+            if (pass == POPULATE)
+                populate(i);
+            else if (pass == SCATTER)
+                scatter(i);
+            else
+                __atomic_add_fetch(&added, table->addLoaded(table->shards[i], items + starts[i],
+                                                            starts[i + 1] - starts[i]), __ATOMIC_RELAXED);
+        }
+    }
+};
+
+class TableLoadThread: public Thread
+{
+public:
+    TableLoadJob *job;
+private:
+    void main(void) { job->run(); }
+};
+
+/* Dedupe and insert the entries loaded for a shard */
+unsigned Table::addLoaded(Shard &shard, TableLoadItem *items, unsigned n)
+{
+    unsigned added = 0;
+    unsigned i;
+
+    qsort(items, n, sizeof(TableLoadItem), loadCompare);
+    for (i = 0; i < n; i += TABLE_LOAD_BATCH) {
+        unsigned end = i + TABLE_LOAD_BATCH < n ? i + TABLE_LOAD_BATCH : n;
+        shard.tableLock.enter();
+        if (!i) { //size the index just once
+            unsigned nbuckets;
+            do {
+                nbuckets = shard.nbuckets;
+                if (shard.count + n < nbuckets * TABLE_MAX_LOAD)
+                    break;
+                grow(shard);
+            } while (shard.nbuckets != nbuckets);
+        }
+        for (unsigned j = i; j < end; j++) {
+            TableEntry *Entry = items[j].Entry;
+            if (j + 1 < n && items[j + 1].Entry->hash == Entry->hash &&
+                !strcmp(items[j + 1].Entry->name, Entry->name))
+                continue; //a later line has the same name
+            if (shard.findBucket(Entry->name, Entry->hash) || !insert(shard, Entry))
+                continue;
+            items[j].Entry = NULL;
+            added++;
+        }
+        shard.tableLock.leave();
+        for (unsigned j = i; j < end; j++)
+            delete items[j].Entry;
+        if (caching)
+            evict(shard);
+    }
+    return added;
+}
+
+unsigned Table::addLines(char *buf, size_t len, TableEntryFactory factory, unsigned nthreads)
+{
+    TableLoadJob job;
+    unsigned i;
+
+    if (!nthreads)
+        nthreads = 1;
+    /* The last line may have no '\n' and no room for the '\0' */
+    char *body_end = buf;
+    for (char *nl = buf + len; nl > buf; nl--)
+        if (nl[-1] == '\n') {
+            body_end = nl;
+            break;
+        }
+    size_t tail_len = buf + len - body_end;
+    char *tail = NULL;
+    if (tail_len) {
+        if (!(tail = (char *) malloc(tail_len + 1)))
+            return 0;
+        memcpy(tail, body_end, tail_len);
+        tail[tail_len] = '\0';
+    }
+
+    size_t body_len = body_end - buf;
+    unsigned nchunks = body_len / TABLE_LOAD_CHUNK + 1;
+    if (nchunks < nthreads * 4)
+        nchunks = nthreads * 4;
+    if (nchunks > body_len / 4096 + 1)
+        nchunks = body_len / 4096 + 1;
+    job.pass = TableLoadJob::POPULATE;
+    job.table = this;
+    job.factory = factory;
+    job.nchunks = nchunks + 1; //the tail
+    job.chunks = (TableLoadChunk *) calloc(job.nchunks, sizeof(TableLoadChunk));
+    job.counts = (unsigned *) calloc((size_t) job.nchunks * nshards, sizeof(unsigned));
+    job.starts = (unsigned *) malloc((nshards + 1) * sizeof(unsigned));
+    job.items = NULL;
+    job.next = 0;
+    job.added = 0;
+    if (!job.chunks || !job.counts || !job.starts) {
+        free(job.chunks);
+        free(job.counts);
+        free(job.starts);
+        free(tail);
+        return 0;
+    }
+    /* Split on line boundaries */
+    char *start = buf;
+    for (i = 0; i < nchunks; i++) {
+        char *end = body_end;
+        if (i + 1 < nchunks) {
+            end = buf + body_len / nchunks * (i + 1);
+            if (end < start)
+                end = start;
+            if (end < body_end)
+                end = (char *) memchr(end, '\n', body_end - end) + 1;
+        }
+        job.chunks[i].start = start;
+        job.chunks[i].end = end;
+        start = end;
+    }
+    job.chunks[nchunks].start = tail;
+    job.chunks[nchunks].end = tail + tail_len;
+
+    TableLoadThread *threads = NULL;
+    if (nthreads > 1)
+        threads = new TableLoadThread[nthreads - 1];
+    for (int pass = TableLoadJob::POPULATE; pass <= TableLoadJob::INSERT; pass++) {
+        if (pass == TableLoadJob::SCATTER) {
+            /* turn the counts into where each chunk's entries for each shard go */
+            unsigned total = 0;
+            for (unsigned s = 0; s < nshards; s++) {
+                job.starts[s] = total;
+                for (unsigned c = 0; c < job.nchunks; c++) {
+                    unsigned count = job.counts[c * nshards + s];
+                    job.counts[c * nshards + s] = total;
+                    total += count;
+                }
+            }
+            job.starts[nshards] = total;
+            job.items = (TableLoadItem *) malloc((total ? total : 1) * sizeof(TableLoadItem));
+            if (!job.items) {
+                for (unsigned c = 0; c < job.nchunks; c++) {
+                    for (i = 0; i < job.chunks[c].count; i++)
+                        delete job.chunks[c].entries[i];
+                    free(job.chunks[c].entries);
+                }
+                break;
+            }
+        }
+        job.pass = (TableLoadJob::Pass) pass;
+        job.next = 0;
+        for (i = 0; threads && i < nthreads - 1; i++) {
+            threads[i].job = &job;
+            threads[i].StartThread(false); //if this fails the others take up the slack
+        }
+        job.run();
+        for (i = 0; threads && i < nthreads - 1; i++)
+            threads[i].WaitThread();
+    }
+    delete[] threads;
+    free(job.items);
+    free(job.starts);
+    free(job.counts);
+    free(job.chunks);
+    free(tail);
+    return job.added;
+}
+
+/* mmap() the file rather than read() it, so the threads fault
+   in their own chunks. It's mapped private so we can write to it. */
+unsigned Table::addFile(const char *path, TableEntryFactory factory, unsigned nthreads)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return 0;
+    struct stat st;
+    char *buf = (char *) MAP_FAILED;
+    if (!fstat(fd, &st) && st.st_size > 0)
+        buf = (char *) mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED)
+        return 0;
+    unsigned added = addLines(buf, st.st_size, factory, nthreads);
+    munmap(buf, st.st_size);
+    return added;
+}
+
+/* dump() file format, in native byte order:
+     header
+     records, each 8 byte aligned
+     nslots slots, an open addressed hash index of the records
+   so load() need only mmap() it, and lookups go straight to a record.
+   Files from another version of this format, or written in the other
+   byte order, are refused rather than misread. */
+
+#define TABLE_MAP_MAGIC "PadTable"
+#define TABLE_MAP_VERSION 1
+#define TABLE_MAP_BYTE_ORDER 0x01020304
+#define TABLE_MAP_ALIGN(len) (((len) + 7) & ~(size_t) 7)
+
+struct TableMapHeader {
+    char magic[8];      /* TABLE_MAP_MAGIC, without the '\0' */
+    uint32_t version;   /* TABLE_MAP_VERSION */
+    uint32_t byte_order;/* TABLE_MAP_BYTE_ORDER, as written */
+    uint32_t count;     /* records */
+    uint32_t nslots;    /* power of 2 >= 2*count, so there's always an empty slot */
+    uint64_t slots;     /* offset of the index */
+};
+
+struct TableMapSlot {
+    uint32_t hash;
+    uint32_t unused;
+    uint64_t record;    /* offset, or 0 for empty */
+};
+
+struct TableMapRecord {
+    uint32_t name_len;
+    uint32_t data_len;
+    /* then name, '\0', padding, data, padding */
+};
+
+struct TableMap {
+    char *base;
+    size_t len;
+    const TableMapSlot *slots;
+    unsigned nslots;
+    unsigned char *loaded;      /* per slot, set once faulted in or deleted */
+    unsigned left;              /* records not yet loaded */
+    TableEntryFactory factory;
+};
+
+bool Table::dump(const char *path)
+{
+    faultAll();
+    unsigned nrecs = 64;
+    TableMapSlot *recs = (TableMapSlot *) malloc(nrecs * sizeof(TableMapSlot)); /* in file order */
+    size_t tmp_len = strlen(path) + sizeof(".tmp");
+    char *tmp = (char *) malloc(tmp_len);
+    FILE *f = NULL;
+    if (recs && tmp) {
+        snprintf(tmp, tmp_len, "%s.tmp", path);
+        f = fopen(tmp, "wb");
+    }
+
+    static const char zeros[8] = { 0 };
+    TableMapHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TABLE_MAP_MAGIC, sizeof(header.magic));
+    header.version = TABLE_MAP_VERSION;
+    header.byte_order = TABLE_MAP_BYTE_ORDER;
+    bool ok = f && fwrite(&header, sizeof(header), 1, f) == 1;
+    uint64_t offset = sizeof(header);
+    size_t buf_len = 256;
+    void *buf = malloc(buf_len);
+    ok = ok && buf;
+
+    WalkCursor c;
+    walkStart(&c, false);
+    TableEntry *Entry;
+    while (ok && (Entry = walkStep(&c))) {
+        Entry->acquireShared();
+        if (Entry->linked()) {
+            size_t len = Entry->pack(buf, buf_len);
+            if (len != TABLE_NO_PACK && len > buf_len) {
+                void *bigger = realloc(buf, len);
+                if (bigger) {
+                    buf = bigger;
+                    buf_len = len;
+                    len = Entry->pack(buf, buf_len);
+                } else {
+                    len = TABLE_NO_PACK;
+                }
+            }
+            if (header.count == nrecs) {
+                TableMapSlot *bigger = NULL;
+                if (nrecs < 0x40000000)
+                    bigger = (TableMapSlot *) realloc(recs, nrecs * 2 * sizeof(TableMapSlot));
+                if (bigger) {
+                    recs = bigger;
+                    nrecs *= 2;
+                } else {
+                    len = TABLE_NO_PACK;
+                }
+            }
+            TableMapRecord record;
+            record.name_len = strlen(Entry->name);
+            record.data_len = len;
+            size_t name_len = TABLE_MAP_ALIGN(record.name_len + 1);
+            ok = len != TABLE_NO_PACK && len <= UINT32_MAX &&
+                 fwrite(&record, sizeof(record), 1, f) == 1 &&
+                 fwrite(Entry->name, record.name_len + 1, 1, f) == 1 &&
+                 fwrite(zeros, name_len - record.name_len - 1, 1, f) <= 1 &&
+                 (!len || fwrite(buf, len, 1, f) == 1) &&
+                 fwrite(zeros, TABLE_MAP_ALIGN(len) - len, 1, f) <= 1;
+            if (ok) {
+                recs[header.count].hash = Entry->hash;
+                recs[header.count].unused = 0;
+                recs[header.count].record = offset;
+                offset += sizeof(record) + name_len + TABLE_MAP_ALIGN(len);
+                header.count++;
+            }
+        }
+        Entry->releaseShared();
+    }
+    walkEnd(&c);
+    free(buf);
+
+    /* Now we know how many there are, hash them into the index */
+    unsigned nslots = 1;
+    while (nslots < 2 * header.count)
+        nslots *= 2;
+    TableMapSlot *slots = NULL;
+    if (ok && !(slots = (TableMapSlot *) calloc(nslots, sizeof(TableMapSlot))))
+        ok = false;
+    for (unsigned i = 0; ok && i < header.count; i++) {
+        unsigned s = recs[i].hash & (nslots - 1);
+        while (slots[s].record)
+            s = (s + 1) & (nslots - 1);
+        slots[s] = recs[i];
+    }
+    free(recs);
+
+    header.nslots = nslots;
+    header.slots = offset;
+    ok = ok && fwrite(slots, sizeof(TableMapSlot), nslots, f) == nslots &&
+         !fseek(f, 0, SEEK_SET) && fwrite(&header, sizeof(header), 1, f) == 1 &&
+         !fflush(f) && !fsync(fileno(f));
+    if (f && fclose(f))
+        ok = false;
+    if (ok)
+        ok = !rename(tmp, path);
+    else if (f)
+        ::unlink(tmp);
+    free(tmp);
+    free(slots);
+    return ok;
+}
+
+bool Table::load(const char *path, TableEntryFactory factory)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    char *base = (char *) MAP_FAILED;
+    if (!fstat(fd, &st) && st.st_size >= (off_t) sizeof(TableMapHeader))
+        base = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return false;
+
+    size_t len = st.st_size;
+    const TableMapHeader *header = (const TableMapHeader *) base;
+    TableMap *m = NULL;
+    if (!memcmp(header->magic, TABLE_MAP_MAGIC, sizeof(header->magic)) &&
+        header->version == TABLE_MAP_VERSION && header->byte_order == TABLE_MAP_BYTE_ORDER &&
+        header->nslots && !(header->nslots & (header->nslots - 1)) &&
+        header->count < header->nslots && !(header->slots & 7) &&
+        header->slots <= len && (len - header->slots) / sizeof(TableMapSlot) >= header->nslots &&
+        (m = (TableMap *) malloc(sizeof(TableMap)))) {
+        m->base = base;
+        m->len = len;
+        m->slots = (const TableMapSlot *) (base + header->slots);
+        m->nslots = header->nslots;
+        m->left = 0;
+        m->factory = factory;
+        m->loaded = (unsigned char *) calloc(m->nslots, 1);
+        if (!m->loaded) {
+            free(m);
+            m = NULL;
+        }
+        for (unsigned s = 0; m && s < m->nslots; s++)
+            m->left += m->slots[s].record != 0;
+    }
+    if (!m) {
+        munmap(base, len);
+        return false;
+    }
+
+    /* The names in the file aren't checked against those in the table,
+       so only load into an empty one. Holding every shard stops adds
+       until the map is in place. */
+    unsigned i;
+    mapLock.enter();
+    bool ok = !map; //else already loading one
+    for (i = 0; i < nshards; i++)
+        shards[i].tableLock.enter();
+    for (i = 0; ok && i < nshards; i++)
+        ok = !shards[i].count;
+    if (ok) {
+        for (unsigned s = 0; s < m->nslots; s++)
+            if (m->slots[s].record)
+                filterCount(m->slots[s].hash, true);
+        __atomic_store_n(&map, m, __ATOMIC_RELEASE);
+    }
+    for (i = 0; i < nshards; i++)
+        shards[i].tableLock.leave();
+    if (ok && !m->left)
+        unmap();
+    mapLock.leave();
+    if (!ok) {
+        free(m->loaded);
+        free(m);
+        munmap(base, len);
+    }
+    return ok;
+}
+
+/* Return the record's name, or NULL if it doesn't fit in the file */
+static const char *recordName(const TableMap *m, unsigned slot, const TableMapRecord **record)
+{
+    uint64_t offset = m->slots[slot].record;
+    if ((offset & 7) || offset > m->len - sizeof(TableMapRecord))
+        return NULL;
+    const TableMapRecord *r = (const TableMapRecord *) (m->base + offset);
+    offset += sizeof(TableMapRecord);
+    if (m->len - offset < TABLE_MAP_ALIGN((uint64_t) r->name_len + 1) ||
+        m->base[offset + r->name_len])
+        return NULL;
+    offset += TABLE_MAP_ALIGN((uint64_t) r->name_len + 1);
+    if (m->len - offset < r->data_len)
+        return NULL;
+    *record = r;
+    return m->base + offset - TABLE_MAP_ALIGN((uint64_t) r->name_len + 1);
+}
+
+/* add() the entry for the slot. Must hold mapLock */
+bool Table::materialize(unsigned slot)
+{
+    const TableMapRecord *record;
+    const char *Name = recordName(map, slot, &record);
+    TableEntry *Entry = NULL;
+
+    map->loaded[slot] = 1;
+    map->left--;
+    if (Name)
+        Entry = map->factory();
+    if (Entry) {
+        const char *data = Name + TABLE_MAP_ALIGN(record->name_len + 1);
+        if (!Entry->setName(Name) || !Entry->unpack(data, record->data_len) || !add(Entry)) {
+            delete Entry;
+            Entry = NULL;
+        }
+    }
+    filterCount(map->slots[slot].hash, false); //now counted as an entry, if added
+    return Entry != NULL;
+}
+
+/* Load Name from the mapped file if it's there and not already loaded.
+   Returns whether it was ever there, so worth looking up again. */
+bool Table::faultIn(const char *Name, unsigned hash)
+{
+    bool found = false;
+
+    mapLock.enter();
+    if (map) {
+        unsigned mask = map->nslots - 1;
+        for (unsigned s = hash & mask, n = 0; n < map->nslots && map->slots[s].record; s = (s + 1) & mask, n++) {
+            const TableMapRecord *record;
+            const char *slotName;
+            if (map->slots[s].hash != hash ||
+                !(slotName = recordName(map, s, &record)) || strcmp(slotName, Name))
+                continue;
+            found = true;
+            if (!map->loaded[s]) {
+                materialize(s);
+                break;
+            }
+        }
+        if (!map->left)
+            unmap();
+    }
+    mapLock.leave();
+    return found;
+}
+
+/* Load everything left in the mapped file, for walks */
+void Table::faultAll(void)
+{
+    if (!__atomic_load_n(&map, __ATOMIC_ACQUIRE))
+        return;
+    mapLock.enter();
+    for (unsigned s = 0; map && s < map->nslots; s++)
+        if (map->slots[s].record && !map->loaded[s])
+            materialize(s);
+    unmap();
+    mapLock.leave();
+}
+
+/* del() Name from the mapped file, without loading it */
+bool Table::unmapName(const char *Name, unsigned hash)
+{
+    bool found = false;
+
+    mapLock.enter();
+    if (map) {
+        unsigned mask = map->nslots - 1;
+        for (unsigned s = hash & mask, n = 0; n < map->nslots && map->slots[s].record; s = (s + 1) & mask, n++) {
+            const TableMapRecord *record;
+            const char *slotName;
+            if (map->loaded[s] || map->slots[s].hash != hash ||
+                !(slotName = recordName(map, s, &record)) || strcmp(slotName, Name))
+                continue;
+            map->loaded[s] = 1;
+            map->left--;
+            filterCount(map->slots[s].hash, false);
+            found = true;
+            break;
+        }
+        if (!map->left)
+            unmap();
+    }
+    mapLock.leave();
+    return found;
+}
+
+/* Release the mapped file. Must hold mapLock */
+void Table::unmap(void)
+{
+    TableMap *m = map;
+    if (!m)
+        return;
+    __atomic_store_n(&map, (TableMap *) NULL, __ATOMIC_RELEASE);
+    munmap(m->base, m->len);
+    free(m->loaded);
+    free(m);
+}
+
+/* Like addIndex() all the locks are held while the filter is filled,
+   so no name is added or deleted without it being counted */
+bool Table::setFilter(unsigned max_entries)
+{
+    unsigned size = 64;
+    while (size < 0x80000000U && size / TABLE_FILTER_PER_ENTRY < max_entries)
+        size *= 2;
+    unsigned char *f = (unsigned char *) calloc(size, 1);
+    if (!f)
+        return false;
+
+    unsigned i;
+    bool ok;
+    mapLock.enter();
+    for (i = 0; i < nshards; i++)
+        shards[i].tableLock.enter();
+    ok = !filter;
+    if (ok) { //filled before lock free readers can see it
+        for (i = 0; i < nshards; i++)
+            for (llist_entry *node = shards[i].table; node; node = node->next)
+                if (!((TableNode *) node)->died)
+                    filterBump(f, size, ((TableEntry *) node->val)->hash, true);
+        for (unsigned s = 0; map && s < map->nslots; s++)
+            if (map->slots[s].record && !map->loaded[s])
+                filterBump(f, size, map->slots[s].hash, true);
+        filter_size = size;
+        __atomic_store_n(&filter, f, __ATOMIC_RELEASE);
+    }
+    for (i = 0; i < nshards; i++)
+        shards[i].tableLock.leave();
+    mapLock.leave();
+    if (!ok)
+        free(f);
+    return ok;
+}
+
+void Table::getFilterStats(TableFilterStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (unsigned i = 0; i < nshards; i++) {
+        Shard &shard = shards[i];
+        stats->lookups += __atomic_load_n(&shard.filter_lookups, __ATOMIC_RELAXED);
+        stats->negatives += __atomic_load_n(&shard.filter_negatives, __ATOMIC_RELAXED);
+        stats->false_positives += __atomic_load_n(&shard.filter_false_positives, __ATOMIC_RELAXED);
+    }
+    if (__atomic_load_n(&filter, __ATOMIC_ACQUIRE))
+        stats->bytes = filter_size;
+}
@@ -3,48 +3,589 @@
 
 #include "PadThreads.h"
 #include "llist.h"
+#include "skiplist.h"
+
+struct TableBatchItem;
+struct TableLoadItem;
+struct TableEntry;
+struct TableMap;
+struct TableNode;
+struct Table;
+
+typedef void (*TableEntryFunc)(TableEntry *Entry, void *arg);
+typedef TableEntry *(*TableEntryFactory)(void);
+typedef long long (*TableKeyFunc)(const TableEntry *Entry);
+typedef void (*TableMergeFunc)(TableEntry *Existing, TableEntry *Update);
+/* For tables keyed by something other than names, see Table::setKeys() */
+typedef unsigned (*TableHashFunc)(const char *Name);
+typedef unsigned long long (*TableKeyOfFunc)(const char *Name);
+typedef bool (*TableMatchFunc)(const TableEntry *Entry, const void *Key);
+
+/* The default room for names in a TableEntryInline */
+#define TABLE_NAME_INLINE 32
+
+/* Most secondary indexes a Table can have */
+#define TABLE_MAX_INDEXES 8
+
+/* Returned by TableEntry::pack() for entries that can't be dump()ed */
+#define TABLE_NO_PACK ((size_t) -1)
+
+/* Each entry is locked with a 4 byte FutexRWLock, unless TABLE_PTHREAD_LOCKS
+   is defined in which case it's a (56 byte on linux) pthread rwlock. That's
+   only worth it for the deadlock debugging help that pthreads can give.
+   Note it must be the same for everything including this, so use -D. */
+//#define TABLE_PTHREAD_LOCKS
+#if !defined(TABLE_PTHREAD_LOCKS) && !defined(TABLE_COMPACT_LOCKS)
+#define TABLE_COMPACT_LOCKS
+#endif
+
+/* If TABLE_SLAB is defined, entries (of any derived type) and the table's
+   list nodes come from slabs with per thread caches (see slab.h) rather than
+   malloc(). That avoids fragmenting the heap with lots of adds and dels,
+   though memory is then never given back to the system. Names are still
+   malloc'd. As above, it must be the same for everything. */
+//#define TABLE_SLAB
+
+/* Bookkeeping only some tables need, so entries in other tables don't
+   carry it. Made by Table::add() in tables with setKeys(), addIndex()
+   or setCache(), and freed with the entry. */
+struct TableEntryExtra
+{
+    unsigned long long key; /* key_of(name) in tables with setKeys(), else 0 */
+    long long *index_keys;  /* as of the last add() or reindex(), one per Table index */
+    unsigned expires;       /* in cache tables, when this is no longer found, or 0 */
+    unsigned charge;        /* bytes() as counted by a cache table */
+    bool referenced;        /* found since the cache's clock hand last passed */
+};
 
 struct TableEntry
 {
+    /* Something malloc'd, or in a TableEntryInline maybe the entry itself.
+       Note with setName() you don't need to care which. */
     char *name;
 
-    CriticalSection lock;
+    /* Table bookkeeping. Only touch these while holding the shard's tableLock.
+       With the default locks an entry is 56 bytes on 64 bit systems, so fits
+       in a cache line (without LOCK_PROFILE). */
+    unsigned hash;          /* hashName(name), set by Table::add() */
+#ifdef TABLE_COMPACT_LOCKS
+    FutexRWLock lock;
+#else
+    rwlock lock;
+#endif
+    TableEntry *hash_next;  /* next entry in the same hash bucket */
+    llist_entry *node;      /* our node in the Table's llist */
+    unsigned seq;           /* bumped by acquire() and release(), so odd while held */
+    unsigned refs;          /* the table's reference + any snapshot walks, and flags */
+    TableEntryExtra *extra; /* see above, or NULL */
+
+    enum {
+        LINKED = 1U << 31,  /* in refs while the entry is in a table */
+        KEPT = 1U << 30     /* and once unlinked, if its node was left for walks */
+    };
+
+#ifdef LOCK_PROFILE
+    /* For Table::lockReport() */
+    unsigned lock_acquires;
+    unsigned lock_contended;
+    unsigned long long lock_wait_ns;
+    unsigned long long lock_since;  /* when acquire()d */
+    static LockStats lockStats;     /* of all entries */
+#endif
 
     TableEntry();
     TableEntry(const TableEntry & rhs);
     virtual ~TableEntry();
+#ifdef TABLE_SLAB
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr, size_t size);
+#endif
 
     virtual bool populate(void *) = 0;
     virtual void print(void) = 0;
+    /* For Table::dump() and Table::load(). pack() copies the entry's data
+       (not its name) to buf and returns its length, or if that's more than
+       len just returns the length needed. unpack() does the reverse, and must
+       copy what it needs as buf is unmapped once all entries are loaded. */
+    virtual size_t pack(void *buf, size_t len) const;
+    virtual bool unpack(const void *buf, size_t len);
+    /* Memory used by the entry, for cache tables with a byte limit.
+       Override to count your own fields. */
+    virtual size_t bytes(void) const;
+    /* A new copy of the entry, for Table::getForUpdate() to change in place
+       of one that is still in a TableSnapshot. Usually just
+         TableEntry *clone(void) const { return new myEntry(*this); }
+       The default returns NULL, in which case the entry is changed in place,
+       so snapshots see the changes and must be read with atShared(). */
+    virtual TableEntry *clone(void) const;
+    /* For cache tables, expire secs from now rather than the table's ttl.
+       Returns false if out of memory. */
+    bool expireIn(unsigned secs);
 
     static int compare(const void *entry1, const void *entry2);
     static int findName(const void *entry, const void *name);
+    static unsigned hashName(const char *name);
+
+    /* Set name, avoiding a malloc for names that fit in nameBuf() */
+    bool setName(const char *Name);
+    /* Where setName() can keep short names, and its size. None in a
+       plain TableEntry, see TableEntryInline. */
+    virtual char *nameBuf(size_t *len) const;
+    /* Whether the entry is in a table. Once del()eted, those that
+       acquire() it or peek() it can see it's gone with this. */
+    bool linked(void) const { return __atomic_load_n(&refs, __ATOMIC_ACQUIRE) & LINKED; }
 
     void acquire(void);
     void release(void);
+    /* For those only reading the entry, who can hold it at the same time.
+       A waiting acquire() goes ahead of new readers, so a thread mustn't
+       acquireShared() an entry it already holds. */
+    bool tryAcquire(void);  /* acquire() unless someone else holds it */
+    void acquireShared(void);
+    void releaseShared(void);
+
+    /* For readers that would rather not lock the entry, and just retry
+       if they overlap with a writer (one that has acquire()d it).
+       The entry must be kept from being freed, by ref() or Table::peek().
+         do {
+             seq = entry->readBegin();
+             copy fields...
+         } while (entry->readRetry(seq));
+       Note copied pointers may be invalid, so only dereference them
+       once readRetry() has returned false. */
+    unsigned readBegin(void) const {
+        unsigned s;
+        while ((s = __atomic_load_n(&seq, __ATOMIC_ACQUIRE)) & 1)
+            sched_yield();
+        return s;
+    }
+    bool readRetry(unsigned s) const {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return __atomic_load_n(&seq, __ATOMIC_RELAXED) != s;
+    }
+
+    /* Fields that are updated on their own, like hit counters or last
+       used times, can be Atomic<> (see PadThreads.h) and then updated
+       without acquire()ing the entry at all, through Table::peek():
+         if ((entry = (myEntry *) table.peek(name))) {
+             entry->hits.add(1);
+             entry->unref();
+         }
+       Walkers and readBegin() readers can load() them at any time,
+       but they aren't covered by readRetry(), so keep fields that must
+       agree with each other under acquire(). */
+
+    /* Keep the entry from being freed, though not from being
+       deleted from the table. The last unref() frees it. */
+    void ref(void) { __atomic_add_fetch(&refs, 1, __ATOMIC_RELAXED); }
+    void unref(void) { if (!(__atomic_sub_fetch(&refs, 1, __ATOMIC_ACQ_REL) & ~KEPT)) delete this; }
+};
+
+/* An entry with room for names shorter than N in the entry itself,
+   so setName() doesn't malloc() them. Derive from this rather than
+   TableEntry where most names are short. */
+template <unsigned N = TABLE_NAME_INLINE>
+struct TableEntryInline : TableEntry
+{
+    char name_buf[N];
+
+    TableEntryInline() {}
+    TableEntryInline(const TableEntryInline & rhs) : TableEntry(rhs) {
+        if (name)
+            setName(name); //TableEntry(rhs) couldn't use name_buf
+    }
+    ~TableEntryInline() {
+        if (name == name_buf)
+            name = NULL; //not for ~TableEntry() to free
+    }
+    char *nameBuf(size_t *len) const { *len = N; return (char *) name_buf; }
+    size_t bytes(void) const { return TableEntry::bytes() + N; }
+};
+
+/* Table flags */
+enum {
+    /* get() and walks take no table level locks. del() doesn't wait
+       for walkers, instead deleted entries are freed once all readers
+       that could have seen them are finished. Walks must be ended early
+       with abortWalk(&cursor), and there is no need for resumeWalk(). */
+    TABLE_EPOCH = 0x01,
+    /* Walks see the table as it was when getFirst() was called, without
+       holding any table level locks between entries, so del() is never
+       blocked by walkers. Entries deleted during a walk are kept (though
+       get() doesn't find them) until all walks that could see them are
+       finished. Walks must be ended early with abortWalk(&cursor), and
+       there is no need for resumeWalk(). */
+    TABLE_SNAPSHOT = 0x02,
+    /* Also keep the entries in a name ordered index. getFirst()/getNext()
+       then walk in name order, seeing the table as for TABLE_SNAPSHOT,
+       and getFirstInRange()/getFirstWithPrefix() can be used. */
+    TABLE_ORDERED = 0x04
+};
+
+/* A change logged by a Table, see Table::logChanges() */
+enum { TABLE_ADDED, TABLE_DELETED, TABLE_UPDATED };
+
+struct TableChange {
+    unsigned long long seq;
+    int type;
+    TableEntry *Entry;      /* ref()d, so unref() it when done */
+};
+
+struct TableFilterStats {
+    unsigned long lookups;          /* get()s and del()s checked against the filter */
+    unsigned long negatives;        /* of those, names known to be missing */
+    unsigned long false_positives;  /* names that might have been there but weren't */
+    size_t bytes;                   /* the size of the filter */
+};
+
+struct TableCacheStats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long expirations;
+    unsigned long entries;
+    size_t bytes;
+};
+
+/* A read only view of a whole table as it was when Table::snapshot() was
+   taken, for backups and reports that take a while. Entries are shared with
+   the table until they're changed through Table::getForUpdate(), which then
+   replaces them in the table with a copy. So if the entries have a clone(),
+   no locks are needed to read a snapshot. Otherwise they're changed in place
+   under their lock, so use atShared() and getShared(), which acquireShared()
+   the entry, and releaseShared() it when done. Entries in a snapshot may have
+   been deleted from the table since. Entries are in name order.
+   unref() it when done, before the table is deleted. */
+struct TableSnapshot {
+    unsigned size(void) const { return count; }
+    TableEntry *at(unsigned i) const { return entries[i]; }
+    TableEntry *atShared(unsigned i) const;
+    /* Binary search for Name, or NULL */
+    TableEntry *get(const char *Name) const;
+    TableEntry *getShared(const char *Name) const;
+
+    void ref(void) { __atomic_add_fetch(&refs, 1, __ATOMIC_RELAXED); }
+    void unref(void);
+
+  private:
+    friend struct Table;
+    TableSnapshot() {}
+    ~TableSnapshot() {}
+
+    Table *table;
+    TableEntry **entries;   /* each ref()d */
+    unsigned count;
+    int refs;
 };
 
 struct Table {
-    Table();
+    /* The entries are split across "shards" independently locked
+       partitions, chosen by a hash of the name. Operations on different
+       shards don't contend with each other, and a walk only blocks
+       deletions from the shard it's currently in. A deletion waiting
+       for a shard holds up new walks of it, so without the EPOCH,
+       SNAPSHOT or ORDERED flags a thread mustn't start walking a table
+       while already walking it. */
+    Table(unsigned Shards = 1, unsigned Flags = 0);
     virtual ~Table();
     bool add(TableEntry * Entry);
     TableEntry *get(const char *Name);
+    TableEntry *getShared(const char *Name); /* releaseShared() when done */
     bool del(const char *Name);
+    /* get() Name, or if it's not there make an entry with factory(), name it
+       and add() it, all in one hold of the shard's lock, so that threads racing
+       to create the same name all get the one entry. factory() is called with
+       the shard locked, so it mustn't use the table. The entry is returned
+       acquire()d, with created (if not NULL) saying whether it's new, so it can
+       be filled in before anyone else gets it. Returns NULL on failure. */
+    TableEntry *getOrCreate(const char *Name, TableEntryFactory factory, bool *created = NULL);
+    /* add() Entry, replacing any entry of the same name, or if merge is given,
+       call merge(existing, Entry) with the existing entry acquire()d and then
+       unref() Entry. Either way nobody sees the name missing. Like del(),
+       replacing waits for walks of the shard in tables without EPOCH,
+       SNAPSHOT or ORDERED flags. Returns false on failure (out of memory),
+       in which case you still own Entry, though the existing entry
+       may have been deleted. */
+    bool upsert(TableEntry *Entry, TableMergeFunc merge = NULL);
+    /* Like get() but the entry is ref()d rather than acquire()d,
+       for use with TableEntry::readBegin(). unref() when finished. */
+    TableEntry *peek(const char *Name);
+
+    /* Take a consistent TableSnapshot of the whole table. This waits for
+       entries currently acquire()d to be released, so don't hold any entry of
+       the table while calling it. Returns NULL if out of memory. */
+    TableSnapshot *snapshot(void);
+    /* get() Name to change it. If the entry may be in a live snapshot, it's
+       replaced in the table by an acquire()d clone() which is returned instead,
+       so the snapshot keeps the entry as it was. Changes made to entries got
+       any other way are seen by snapshots. As with upsert() replacing waits for
+       walks of the shard in tables without EPOCH, SNAPSHOT or ORDERED flags,
+       and if out of memory NULL is returned and the entry may have been deleted.
+       If clone() returns NULL, the entry is returned as for get(). A change
+       log sees the replacement as a TABLE_UPDATED of the copy. */
+    TableEntry *getForUpdate(const char *Name);
+
+    /* For TypedTable, which finds entries by keys rather than making them
+       into names each time. Call setKeys() before anything is added. Names
+       are then hashed with Hash(), and each entry's key field is set to
+       KeyOf(name) as it's added. The Match calls are like get(), getShared(),
+       peek() and del(), for the entry with the hash of Key that match(entry,
+       Key) accepts. They don't see entries still in a load()ed file though,
+       so use the names while mapped() is true. */
+    void setKeys(TableHashFunc Hash, TableKeyOfFunc KeyOf);
+    TableEntry *getMatch(const void *Key, unsigned hash, TableMatchFunc match);
+    TableEntry *getMatchShared(const void *Key, unsigned hash, TableMatchFunc match);
+    TableEntry *peekMatch(const void *Key, unsigned hash, TableMatchFunc match);
+    bool delMatch(const void *Key, unsigned hash, TableMatchFunc match);
+    bool mapped(void) { return __atomic_load_n(&map, __ATOMIC_ACQUIRE) != NULL; }
+
+    /* As above, for n items at a time, taking each shard's locks just once.
+       See table.cpp for details. */
+    unsigned addMany(TableEntry **Entries, unsigned n, bool *results);
+    unsigned getMany(const char * const *Names, unsigned n, TableEntry **Entries);
+    unsigned delMany(const char * const *Names, unsigned n, bool *results);
 
     TableEntry *getFirst(void **cursor);
     TableEntry *getNext(void **cursor);
+    /* As above, but each entry is acquireShared() */
+    TableEntry *getFirstShared(void **cursor);
+    TableEntry *getNextShared(void **cursor);
+    /* Only for TABLE_ORDERED tables. Walk the entries with lo <= name < hi
+       (NULL meaning unbounded), or those whose name starts with prefix,
+       in name order. Continue the walk with getNext() as usual,
+       or getNextShared() if shared. */
+    TableEntry *getFirstInRange(void **cursor, const char *lo, const char *hi, bool shared = false);
+    TableEntry *getFirstWithPrefix(void **cursor, const char *prefix, bool shared = false);
+
+    /* Secondary indexes on keys extracted from entries by key(), kept up to date
+       by add() and del(). If you change fields that a key is extracted from,
+       call reindex() after, while still holding the entry. addIndex() returns
+       the index to pass to getFirstByKey(), or -1 on failure. */
+    int addIndex(TableKeyFunc key);
+    bool reindex(TableEntry *Entry);
+    /* Walk the entries with lo <= key <= hi in key order, through a snapshot
+       as for getFirstInRange(), whatever the table flags. Continue the walk
+       with getNext() as usual, or getNextShared() if shared. */
+    TableEntry *getFirstByKey(void **cursor, int index, long long lo, long long hi, bool shared = false);
+
+    /* Keep a log of the last capacity adds, deletes and updated()s, so
+       those mirroring the table can just pull what changed. */
+    bool logChanges(unsigned capacity);
+    /* The sequence number of the last change. Take this before walking the
+       table to start a mirror, and then pull changes since it. */
+    unsigned long long changeSeq(void);
+    /* Copy up to max changes after since to out, in the order made.
+       Returns the number copied, or -1 if changes after since have
+       already been dropped from the log, in which case start again. */
+    int changesSince(unsigned long long since, TableChange *out, unsigned max);
+    /* Say you've changed an entry's fields, logging an update
+       and doing a reindex(). Call while still holding the entry. */
+    bool updated(TableEntry *Entry);
+
+    /* Make the table a cache of at most max_entries, and max_bytes as counted
+       by TableEntry::bytes() (0 for no limit), each split evenly over the shards.
+       Entries expire ttl seconds after they're added (0 for never) unless they
+       expireIn() their own time. Adding to a full shard evicts a few entries
+       not found recently (CLOCK). Set this before adding anything.
+       In tables without EPOCH, SNAPSHOT or ORDERED flags, eviction is put off
+       while the shard is being walked, until it's an eighth over its limits.
+       Then, like del(), add() waits for walks of the shard, so don't add()
+       to a full cache while walking it. */
+    void setCache(unsigned max_entries, size_t max_bytes, unsigned ttl);
+    void getCacheStats(TableCacheStats *stats);
+
+    /* Keep a counting Bloom filter of the names in the table (and any load()ed
+       file), sized for about max_entries, so that get()s and del()s of names
+       that aren't there mostly return without taking any lock or searching.
+       It takes 8 bytes per entry, for about 2.5% false positives when full.
+       Returns false if out of memory or there is one already. */
+    bool setFilter(unsigned max_entries);
+    void getFilterStats(TableFilterStats *stats);
+
+    /* Call fn(entry, arg) for every entry, spread over nthreads threads
+       (including the caller). Each entry is acquired (or acquireShared())
+       around the call. Doesn't block del(), but entries deleted before
+       their turn are skipped. */
+    void forEachParallel(TableEntryFunc fn, void *arg, unsigned nthreads, bool shared = false);
+
+    /* Bulk load lines of text, populate()ing entries made by factory()
+       on nthreads threads (including the caller). buf is modified, and
+       populate() must copy whatever it keeps from the line. If a name is
+       repeated the last line wins, and names already in the table are kept.
+       Returns the number added. */
+    unsigned addLines(char *buf, size_t len, TableEntryFactory factory, unsigned nthreads);
+    unsigned addFile(const char *path, TableEntryFactory factory, unsigned nthreads);
+
+    /* Write the entries to a binary file which load() maps straight back in,
+       so a restart doesn't have to populate() everything again.
+       The entries must implement pack() and unpack(). */
+    bool dump(const char *path);
+    /* Map in a dump()ed file, into an empty table. Each entry is made with
+       factory() and unpack()ed only when first looked up or walked,
+       so this takes the same time whatever the size of the file.
+       Returns false if the table isn't empty, or the file is corrupt or
+       was dump()ed by another version or on a machine of the other byte order. */
+    bool load(const char *path, TableEntryFactory factory);
+
+    /* Print the lock statistics gathered if built with -DLOCK_PROFILE:
+       the shard locks, all entries, and the top entries by time waited for */
+    void lockReport(FILE *out, unsigned top);
     /* Note use abort walk if exiting a monacoTable walk before the last item.
        You can also use the abort/resume combination if you want to delete the
        current item and you're sure that no other thread could be deleteing from
        the table. Note be careful when resuming that there is another entry in the
        table (i.e. if the last getNext() returned NULL, then you should not resumeWalk() */
-    void abortWalk(void) { table_rwlock.unlock(); }
-    void resumeWalk(void) { table_rwlock.readlock(); }
+    void abortWalk(void) { shards[0].table_rwlock.unlock(); }
+    void resumeWalk(void) { shards[0].table_rwlock.readlock(); }
+    /* The above only work for single shard tables. These work for any. */
+    void abortWalk(void **cursor);
+    void resumeWalk(void **cursor);
 
   protected:
-    llist_entry* table;
-    CriticalSection tableLock;
-    rwlock table_rwlock;
+    /* Something unlinked in a TABLE_EPOCH table, waiting for readers to finish */
+    struct Retired {
+        void *ptr;
+        void (*destroy)(void *);
+        unsigned long tag;      /* epoch it was unlinked in */
+        Retired *next;
+    };
+
+    struct Shard {
+        llist_entry* table;
+        TableEntry** buckets;   /* hash index into the above list */
+        unsigned nbuckets;      /* always a power of 2 */
+        unsigned count;
+        unsigned generation;    /* odd while buckets are being rebuilt */
+        Retired *retired;
+        TableNode *kept;        /* nodes of unlinked entries left for walks, oldest first */
+        TableNode *kept_tail;
+        skiplist *order;        /* TABLE_ORDERED index of the above, kept entries too */
+        size_t bytes;           /* charged by cached entries */
+        unsigned hand;          /* the cache's clock hand, a bucket */
+        unsigned long hits, misses, evictions, expirations;
+        unsigned long filter_lookups, filter_negatives, filter_false_positives;
+        CriticalSection tableLock;
+        rwlock table_rwlock;
+        char pad[64];           /* keep each shard's locks on their own cache lines */
+
+        Shard();
+        TableEntry **findBucket(const void *Key, unsigned hash, TableMatchFunc match = NULL);
+    };
+    Shard *shards;
+    unsigned nshards;
+    unsigned flags;
+    Epoch epoch;
+    TableHashFunc key_hash;     /* set by setKeys(), or NULL for hashName() */
+    TableKeyOfFunc key_of;
+    TableMap *map;              /* load()ed entries not yet faulted in */
+    CriticalSection mapLock;    /* taken before a shard's tableLock */
+    struct Index {
+        TableKeyFunc key;
+        skiplist *list;
+    } indexes[TABLE_MAX_INDEXES];
+    unsigned nindexes;          /* only changed with all tableLocks held */
+    CriticalSection indexLock;  /* taken after a shard's tableLock */
+    TableChange *changes;       /* ring of the last nchanges changes */
+    unsigned nchanges;          /* a power of 2 */
+    unsigned long long change_seq;
+    unsigned long long change_oldest; /* still in the ring */
+    CriticalSection changeLock; /* taken after a shard's tableLock */
+    /* A walk of the table as of a version, see walkStart() */
+    struct WalkCursor {
+        unsigned long long at;  /* sees entries added by then and not yet deleted */
+        WalkCursor *prev;       /* in walks */
+        WalkCursor *next;
+        unsigned shard;
+        llist_entry *node;      /* the last entry stepped to */
+        bool ordered;           /* really an OrderCursor */
+    };
+    unsigned long long version;     /* bumped as each walk starts */
+    unsigned long long oldest_walk; /* at most the version of the oldest walk, or ~0 */
+    unsigned long long snapshot_at; /* version of the latest snapshot(), or 0 if none are live */
+    int live_snapshots;             /* not yet unref()d */
+    WalkCursor *walks;              /* walks in progress, oldest first */
+    WalkCursor *walks_tail;
+    CriticalSection walkLock;       /* taken after a shard's tableLock */
+    bool caching;
+    unsigned cache_max_entries; /* per shard */
+    size_t cache_max_bytes;     /* per shard */
+    unsigned cache_ttl;
+    unsigned char *filter;      /* counting Bloom filter of name hashes, set once */
+    unsigned filter_size;       /* counters, a power of 2 */
+#ifdef LOCK_PROFILE
+    LockStats tableLockStats;   /* of all the shards */
+    LockStats rwlockStats;
+#endif
+
+    /* Use the high bits of the hash as the buckets use the low ones */
+    unsigned shardIndex(unsigned hash) { return (unsigned) (((unsigned long long) hash * nshards) >> 32); }
+    Shard &shardOf(unsigned hash) { return shards[shardIndex(hash)]; }
+    unsigned hashOf(const char *Name) { return key_hash ? key_hash(Name) : TableEntry::hashName(Name); }
+
+  private:
+    friend struct TableLoadJob;
+    friend struct TableForEachJob;
+    struct EpochCursor {
+        unsigned long ticket;
+        unsigned shard;
+        llist_entry *node;
+    };
+    /* A walk of TABLE_ORDERED tables, merging the shards' indexes */
+    struct OrderCursor {
+        WalkCursor walk;
+        char *hi;               /* where the walk stops, or NULL */
+        skiplist_node *heads[1]; /* really [nshards], each shard's next entry in the walk */
+    };
+    struct SnapshotCursor {
+        unsigned count;
+        unsigned pos;
+        TableEntry *entries[1]; /* each ref()d */
+    };
+
+    bool insert(Shard &shard, TableEntry *Entry, bool log = true, unsigned long long born = 0);
+    TableEntry *unlink(Shard &shard, const void *Key, unsigned hash, TableMatchFunc match = NULL);
+    TableEntry *unlinkAt(Shard &shard, TableEntry **link, bool log = true, unsigned long long *died = NULL);
+    void discard(Shard &shard, TableEntry *Entry);
+    void evict(Shard &shard);
+    void sweep(Shard &shard);
+    void bury(Shard &shard, TableEntry *Entry);
+    TableNode *purge(Shard &shard);
+    TableBatchItem *sortBatch(const char * const *Names, unsigned n);
+    void grow(Shard &shard);
+    void retire(Shard &shard, void *ptr, void (*destroy)(void *));
+    void reclaim(Shard &shard);
+    TableEntry *lookup(Shard &shard, const void *Key, unsigned hash, TableMatchFunc match = NULL);
+    enum { FIND_EXCLUSIVE, FIND_SHARED, FIND_REF };
+    TableEntry *findLoaded(const void *Key, unsigned hash, int mode, TableMatchFunc match = NULL);
+    TableEntry *find(const void *Key, unsigned hash, int mode, TableMatchFunc match = NULL);
+    bool delLoaded(const void *Key, unsigned hash, TableMatchFunc match = NULL);
+    bool delHashed(const void *Key, unsigned hash, TableMatchFunc match);
+    bool faultIn(const char *Name, unsigned hash);
+    void faultAll(void);
+    bool unmapName(const char *Name, unsigned hash);
+    bool materialize(unsigned slot);
+    void unmap(void);
+    unsigned addLoaded(Shard &shard, TableLoadItem *items, unsigned n);
+    void filterCount(unsigned hash, bool add);
+    bool filterMaybe(Shard &shard, unsigned hash);
+    bool indexAdd(TableEntry *Entry);
+    void indexDel(TableEntry *Entry);
+    void logChange(int type, TableEntry *Entry);
+    TableEntry *first(void **cursor, bool shared);
+    TableEntry *next(void **cursor, bool shared);
+    TableEntry *firstFrom(unsigned shard, void **cursor, bool shared);
+    TableEntry *epochWalk(void **cursor, llist_entry *node, bool shared);
+    void walkStart(WalkCursor *c, bool snapshot);
+    void walkEnd(WalkCursor *c);
+    TableEntry *walkStep(WalkCursor *c);
+    TableEntry *orderStep(OrderCursor *c);
+    void walkFree(WalkCursor *c);
+    TableEntry *versionStep(void **cursor, WalkCursor *c, bool shared);
+    TableEntry *snapshotStart(void **cursor, SnapshotCursor *c, bool shared);
+    TableEntry *snapshotNext(void **cursor, bool shared);
+    static bool snapshotPush(SnapshotCursor **c, unsigned *size, TableEntry *Entry);
+    static int orderCompare(const void *entry1, const void *entry2);
+    friend struct TableSnapshot;
 };
 
 #endif //_TABLE_H
@@ -0,0 +1,358 @@
+/* Copyright: Pádraig Brady 2026
+ * Summary: Throughput and latency benchmark for Table
+ * License: LGPL
+ * History:
+ *     18 Oct 2026 : Initial version
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include "table.h"
+#include "PadThreads.h"
+#include "pad.h"
+
+/* Measures the throughput and latency of a Table under a mix of
+   get()s, writes (add() or del()) and walks, from a number of threads.
+   To build:
+
+     g++ -O2 -D_REENTRANT PadThreads.cpp llist.c skiplist.c slab.c table.cpp \
+         table_bench.cpp -o table_bench -lpthread
+
+   Names are drawn from a key space of twice the table size, of which half
+   are present to start with. So gets hit about half the time, and writes
+   add the name if it's missing or del() it if not, keeping the size steady.
+   Each name is only ever written by the same thread, as add() doesn't check
+   for duplicates. */
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "Usage: table_bench [options]\n"
+        "  -n entries   table size (100000)\n"
+        "  -s shards    (16)\n"
+        "  -t threads   (4)\n"
+        "  -d secs      how long to run (5)\n"
+        "  -m g:w:k     relative amounts of gets, writes and walks (90:9:1)\n"
+        "  -l length    entries visited by each walk (100)\n"
+        "  -z theta     zipf skew of the names used, 0 (uniform) to < 1 (0)\n"
+        "  -e -S -o     TABLE_EPOCH, TABLE_SNAPSHOT, TABLE_ORDERED\n"
+        "  -r           get shared (getShared(), getFirstShared())\n"
+        "  -f           keep a Bloom filter of the names (setFilter())\n");
+    exit(EXIT_FAILURE);
+}
+
+class benchRecord: public TableEntry
+{
+    public:
+        int field1;
+
+        bool populate(void *) { return false; };
+        void print(void) { printf("record[%s] = %d\n", name, field1); };
+};
+
+/* Latencies in ns, bucketed by the top 4 bits after the leading 1,
+   so percentiles are accurate to about 6% */
+#define HIST_SUB     16
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+struct histogram {
+    unsigned long long count;
+    unsigned long long buckets[HIST_BUCKETS];
+
+    void add(unsigned long long ns) {
+        unsigned bucket;
+        if (ns < HIST_SUB) {
+            bucket = (unsigned) ns;
+        } else {
+            unsigned msb = 63 - __builtin_clzll(ns);
+            bucket = (msb - 3) * HIST_SUB + (unsigned) ((ns >> (msb - 4)) & (HIST_SUB - 1));
+        }
+        buckets[bucket]++;
+        count++;
+    }
+    void merge(const histogram &h) {
+        for (unsigned i = 0; i < HIST_BUCKETS; i++)
+            buckets[i] += h.buckets[i];
+        count += h.count;
+    }
+    unsigned long long percentile(double p) const {
+        unsigned long long want = (unsigned long long) ceil(count * p), seen = 0;
+        for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen && seen >= want) {
+                if (i < HIST_SUB)
+                    return i;
+                unsigned msb = i / HIST_SUB + 3;
+                return (unsigned long long) (HIST_SUB + i % HIST_SUB) << (msb - 4);
+            }
+        }
+        return 0;
+    }
+};
+
+enum { OP_GET, OP_ADD, OP_DEL, OP_WALK, OP_COUNT };
+static const char *opNames[OP_COUNT] = { "get", "add", "del", "walk" };
+
+static unsigned nentries = 100000;
+static unsigned nshards = 16;
+static unsigned nthreads = 4;
+static unsigned secs = 5;
+static unsigned mix[3] = { 90, 9, 1 };
+static unsigned walk_len = 100;
+static double theta = 0;
+static unsigned flags = 0;
+static bool shared = false;
+static bool filter = false;
+
+static Table *table;
+static unsigned nkeys;          /* 2 * nentries */
+static char **names;
+static char *present;           /* by key, only touched by the key's writer */
+static double zipf_zetan, zipf_eta, zipf_alpha;
+static bool stop;               /* set by main(), so read atomically */
+
+static unsigned long long nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double zeta(unsigned n, double t)
+{
+    double sum = 0;
+    for (unsigned i = 1; i <= n; i++)
+        sum += 1 / pow((double) i, t);
+    return sum;
+}
+
+/* From "Quickly Generating Billion-Record Synthetic Databases", Gray et al */
+static void zipfInit(void)
+{
+    double zeta2 = zeta(2, theta);
+    zipf_zetan = zeta(nkeys, theta);
+    zipf_alpha = 1 / (1 - theta);
+    zipf_eta = (1 - pow(2.0 / nkeys, 1 - theta)) / (1 - zeta2 / zipf_zetan);
+}
+
+static unsigned zipf(double u)
+{
+    double uz = u * zipf_zetan;
+    if (uz < 1)
+        return 0;
+    if (uz < 1 + pow(0.5, theta))
+        return 1;
+    unsigned k = (unsigned) (nkeys * pow(zipf_eta * u - zipf_eta + 1, zipf_alpha));
+    return k < nkeys ? k : nkeys - 1;
+}
+
+class benchThread: public Thread
+{
+public:
+    unsigned id;
+    unsigned long long seed;
+    unsigned long long hits;
+    histogram hists[OP_COUNT];
+
+private:
+    unsigned long long random(void) {
+        /* xorshift64* */
+        seed ^= seed >> 12;
+        seed ^= seed << 25;
+        seed ^= seed >> 27;
+        return seed * 2685821657736338717ULL;
+    }
+    unsigned pickKey(void) {
+        if (theta > 0) {
+            /* spread the popular ranks over the key space */
+            unsigned rank = zipf((random() >> 11) * (1.0 / 9007199254740992.0));
+            return (unsigned) (((unsigned long long) rank * 2654435761U) % nkeys);
+        }
+        return (unsigned) (random() % nkeys);
+    }
+    void get(void) {
+        unsigned key = pickKey();
+        TableEntry *entry = shared ? table->getShared(names[key]) : table->get(names[key]);
+        if (entry) {
+            hits++;
+            if (shared)
+                entry->releaseShared();
+            else
+                entry->release();
+        }
+    }
+    int write(void) {
+        /* use the nearest key that this thread writes */
+        unsigned key = pickKey();
+        key -= key % nthreads;
+        key += id;
+        if (key >= nkeys)
+            key = id;
+        if (present[key]) {
+            table->del(names[key]);
+            present[key] = 0;
+            return OP_DEL;
+        }
+        benchRecord *record = new benchRecord;
+        record->setName(names[key]);
+        record->field1 = key;
+        if (table->add(record))
+            present[key] = 1;
+        else
+            delete record;
+        return OP_ADD;
+    }
+    void walk(void) {
+        void *cursor;
+        unsigned n = 0;
+        TableEntry *entry = shared ? table->getFirstShared(&cursor) : table->getFirst(&cursor);
+        while (entry) {
+            if (shared)
+                entry->releaseShared();
+            else
+                entry->release();
+            if (++n == walk_len) {
+                table->abortWalk(&cursor);
+                break;
+            }
+            entry = shared ? table->getNextShared(&cursor) : table->getNext(&cursor);
+        }
+    }
+    void main(void) {
+        unsigned total = mix[0] + mix[1] + mix[2];
+        while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+            unsigned r = (unsigned) (random() % total);
+            int op = OP_GET;
+            unsigned long long start = nowNs();
+            if (r < mix[0]) {
+                get();
+            } else if (r < mix[0] + mix[1]) {
+                op = write();
+            } else {
+                walk();
+                op = OP_WALK;
+            }
+            hists[op].add(nowNs() - start);
+        }
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int c;
+    while ((c = getopt(argc, argv, "n:s:t:d:m:l:z:eSorf")) != -1) {
+        switch (c) {
+        case 'n': nentries = atoi(optarg); break;
+        case 's': nshards = atoi(optarg); break;
+        case 't': nthreads = atoi(optarg); break;
+        case 'd': secs = atoi(optarg); break;
+        case 'm':
+            if (sscanf(optarg, "%u:%u:%u", &mix[0], &mix[1], &mix[2]) != 3)
+                usage();
+            break;
+        case 'l': walk_len = atoi(optarg); break;
+        case 'z': theta = atof(optarg); break;
+        case 'e': flags |= TABLE_EPOCH; break;
+        case 'S': flags |= TABLE_SNAPSHOT; break;
+        case 'o': flags |= TABLE_ORDERED; break;
+        case 'r': shared = true; break;
+        case 'f': filter = true; break;
+        default: usage();
+        }
+    }
+    if (!nentries || !nshards || !nthreads || mix[0] + mix[1] + mix[2] == 0
+        || theta < 0 || theta >= 1 || !walk_len)
+        usage();
+
+    nkeys = 2 * nentries;
+    names = new char*[nkeys];
+    present = new char[nkeys];
+    for (unsigned i = 0; i < nkeys; i++) {
+        char buf[32];
+        sprintf(buf, "key%u", i);
+        names[i] = strdup(buf);
+        present[i] = 0;
+    }
+    if (theta > 0)
+        zipfInit();
+
+    /* fill every other key, so each writer has its share */
+    table = new Table(nshards, flags);
+    if (filter && !table->setFilter(nkeys)) {
+        fprintf(stderr, "table_bench: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (unsigned i = 0; i < nkeys; i += 2) {
+        benchRecord *record = new benchRecord;
+        record->setName(names[i]);
+        record->field1 = i;
+        if (!table->add(record)) {
+            fprintf(stderr, "table_bench: out of memory\n");
+            return EXIT_FAILURE;
+        }
+        present[i] = 1;
+    }
+
+    benchThread *threads = new benchThread[nthreads];
+    unsigned long long start = nowNs();
+    for (unsigned i = 0; i < nthreads; i++) {
+        threads[i].id = i;
+        threads[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        threads[i].hits = 0;
+        memset(threads[i].hists, 0, sizeof(threads[i].hists));
+        threads[i].StartThread(false);
+    }
+    sleep(secs);
+    __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+    for (unsigned i = 0; i < nthreads; i++)
+        threads[i].WaitThread();
+    double elapsed = (nowNs() - start) / 1e9;
+
+    histogram totals[OP_COUNT];
+    memset(totals, 0, sizeof(totals));
+    unsigned long long hits = 0, ops = 0;
+    for (unsigned i = 0; i < nthreads; i++) {
+        for (int op = 0; op < OP_COUNT; op++)
+            totals[op].merge(threads[i].hists[op]);
+        hits += threads[i].hits;
+    }
+
+    printf("%u entries, %u shards, flags %#x, %u threads, %.1fs, mix %u:%u:%u, ",
+           nentries, nshards, flags, nthreads, elapsed, mix[0], mix[1], mix[2]);
+    if (theta > 0)
+        printf("zipf %.2f\n", theta);
+    else
+        printf("uniform\n");
+    printf("%-6s %12s %12s %10s %10s %10s\n", "op", "count", "ops/s", "p50 ns", "p99 ns", "p999 ns");
+    for (int op = 0; op < OP_COUNT; op++) {
+        const histogram &h = totals[op];
+        ops += h.count;
+        if (!h.count)
+            continue;
+        printf("%-6s %12llu %12.0f %10llu %10llu %10llu\n", opNames[op], h.count, h.count / elapsed,
+               h.percentile(0.5), h.percentile(0.99), h.percentile(0.999));
+    }
+    printf("%-6s %12llu %12.0f\n", "total", ops, ops / elapsed);
+    if (totals[OP_GET].count)
+        printf("get hit rate %.1f%%\n", 100.0 * hits / totals[OP_GET].count);
+    if (filter) {
+        TableFilterStats fs;
+        table->getFilterStats(&fs);
+        if (fs.lookups)
+            printf("filter: %lu lookups, %.1f%% known missing, %.1f%% false positives, %zu bytes\n",
+                   fs.lookups, 100.0 * fs.negatives / fs.lookups,
+                   100.0 * fs.false_positives / fs.lookups, fs.bytes);
+    }
+
+    delete[] threads;
+    delete table;
+    for (unsigned i = 0; i < nkeys; i++)
+        free(names[i]);
+    delete[] names;
+    delete[] present;
+    return EXIT_SUCCESS;
+}
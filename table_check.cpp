@@ -0,0 +1,1578 @@
+/* Copyright: Pádraig Brady 2026
+ * Summary: Deterministic checks of the table features
+ * License: LGPL
+ * History:
+ *     18 Oct 2026 : Initial version
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/wait.h>
+extern "C" {
+#include "slab.h"
+}
+#include "table.h"
+#include "typed_table.h"
+#include "shm_table.h"
+#include "executor.h"
+#include "PadThreads.h"
+#include "pad.h"
+
+/* Small deterministic checks of the table's features, rather than the
+   demonstration in table_test.cpp. Each failed check is printed, and the
+   exit status is the number that failed. */
+
+static int failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("%s:%d: %s\n", __func__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* A name and a number, populate()d from "name value" lines */
+class checkRecord: public TableEntry
+{
+    public:
+        int value;
+
+        checkRecord(int v = 0) { value = v; }
+        bool populate(void *line) {
+            char *name = strsep((char **) &line, " ");
+            if (!name || !*name || !line || !setName(name))
+                return false;
+            value = atoi((char *) line);
+            return true;
+        }
+        void print(void) { printf("%s = %d\n", name, value); }
+        size_t pack(void *buf, size_t len) const {
+            if (len >= sizeof(value))
+                memcpy(buf, &value, sizeof(value));
+            return sizeof(value);
+        }
+        bool unpack(const void *buf, size_t len) {
+            if (len != sizeof(value))
+                return false;
+            memcpy(&value, buf, len);
+            return true;
+        }
+        TableEntry *clone(void) const { return new checkRecord(*this); }
+};
+
+static checkRecord *newRecord(const char *name, int value)
+{
+    checkRecord *r = new checkRecord(value);
+    if (!r->setName(name)) {
+        delete r;
+        return NULL;
+    }
+    return r;
+}
+
+static TableEntry *newCheckRecord(void)
+{
+    return new checkRecord;
+}
+
+/* Add names n0, n1, ... valued 0, 1, ... */
+static void fill(Table &table, int count)
+{
+    for (int i = 0; i < count; i++) {
+        char name[32];
+        sprintf(name, "n%d", i);
+        checkRecord *r = newRecord(name, i);
+        if (!r || !table.add(r)) {
+            delete r;
+            CHECK(!"add");
+        }
+    }
+}
+
+/* The value of name, or -1 if it's not there */
+static int valueOf(Table &table, const char *name)
+{
+    checkRecord *r = (checkRecord *) table.get(name);
+    if (!r)
+        return -1;
+    int value = r->value;
+    r->release();
+    return value;
+}
+
+static int countEntries(Table &table)
+{
+    void *cursor;
+    int n = 0;
+    for (TableEntry *Entry = table.getFirst(&cursor); Entry; Entry = table.getNext(&cursor)) {
+        n++;
+        Entry->release();
+    }
+    return n;
+}
+
+/* Looks up n0..n99 until stopped, counting those it doesn't find */
+class lookupReader: public Thread
+{
+    public:
+        Table *table;
+        int stop;
+        int misses;
+    private:
+        void main(void) {
+            misses = 0;
+            while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+                for (int i = 0; i < 100; i++) {
+                    char name[32];
+                    sprintf(name, "n%d", i);
+                    misses += valueOf(*table, name) != i;
+                }
+        }
+};
+
+/* Names already in the table are always found, while adds grow it */
+static void checkGrowth(Table &table)
+{
+    fill(table, 100);
+    lookupReader readers[4];
+    unsigned i, started;
+    for (started = 0; started < lengthof(readers); started++) {
+        readers[started].table = &table;
+        readers[started].stop = 0;
+        if (!readers[started].StartThread(false))
+            break;
+    }
+    CHECK(started == lengthof(readers));
+    const int count = 20000;
+    for (i = 0; i < (unsigned) count; i++) {
+        char name[32];
+        sprintf(name, "g%u", i);
+        table.add(newRecord(name, i));
+    }
+    int misses = 0;
+    for (i = 0; i < started; i++) {
+        __atomic_store_n(&readers[i].stop, 1, __ATOMIC_RELEASE);
+        readers[i].WaitThread();
+        misses += readers[i].misses;
+    }
+    CHECK(misses == 0);
+
+    int wrong = 0;
+    for (i = 0; i < (unsigned) count; i++) {
+        char name[32];
+        sprintf(name, "g%u", i);
+        wrong += valueOf(table, name) != (int) i;
+    }
+    CHECK(wrong == 0);
+    CHECK(countEntries(table) == 100 + count);
+}
+
+static void checkHashIndex(void)
+{
+    Table table;
+    checkGrowth(table);
+    CHECK(valueOf(table, "g") == -1 && valueOf(table, "n100") == -1);
+
+    /* the latest of a repeated name is found first, even once the table has grown */
+    Table dups;
+    fill(dups, 10);
+    dups.add(newRecord("n5", 50));
+    for (int i = 0; i < 1000; i++) {
+        char name[32];
+        sprintf(name, "g%d", i);
+        dups.add(newRecord(name, i));
+    }
+    CHECK(valueOf(dups, "n5") == 50);
+    CHECK(dups.del("n5") && valueOf(dups, "n5") == 5);
+    CHECK(dups.del("n5") && valueOf(dups, "n5") == -1);
+    CHECK(!dups.del("n5") && !dups.del("x"));
+    CHECK(countEntries(dups) == 1009);
+}
+
+static void checkShards(void)
+{
+    Table table(8);
+    checkGrowth(table);
+
+    /* a walk sees every entry of every shard once */
+    Table small(8);
+    int visits[1000];
+    fill(small, lengthof(visits));
+    memset(visits, 0, sizeof(visits));
+    void *cursor;
+    for (TableEntry *Entry = small.getFirst(&cursor); Entry; Entry = small.getNext(&cursor)) {
+        visits[((checkRecord *) Entry)->value]++;
+        Entry->release();
+    }
+    int wrong = 0;
+    for (unsigned i = 0; i < lengthof(visits); i++)
+        wrong += visits[i] != 1;
+    CHECK(wrong == 0);
+
+    /* and an aborted walk lets dels through */
+    TableEntry *Entry = small.getFirst(&cursor);
+    CHECK(Entry != NULL);
+    if (Entry) {
+        Entry->release();
+        small.abortWalk(&cursor);
+    }
+    CHECK(small.del("n1") && valueOf(small, "n1") == -1);
+}
+
+/* Deletes and adds back c0..c63 until stopped */
+class churner: public Thread
+{
+    public:
+        Table *table;
+        int stop;
+    private:
+        void main(void) {
+            while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+                for (int i = 0; i < 64; i++) {
+                    char name[32];
+                    sprintf(name, "c%d", i);
+                    table->del(name);
+                    table->add(newRecord(name, i));
+                }
+        }
+};
+
+/* Looks up and walks the churned names, counting entries that aren't what they should be */
+class churnReader: public Thread
+{
+    public:
+        Table *table;
+        int wrong;
+    private:
+        void main(void) {
+            wrong = 0;
+            for (int round = 0; round < 200; round++) {
+                for (int i = 0; i < 64; i++) {
+                    char name[32];
+                    sprintf(name, "c%d", i);
+                    checkRecord *r = (checkRecord *) table->get(name);
+                    if (r) {
+                        wrong += r->value != i || strcmp(r->name, name);
+                        r->release();
+                    }
+                }
+                void *cursor;
+                int n = 0;
+                for (TableEntry *Entry = table->getFirst(&cursor); Entry; Entry = table->getNext(&cursor)) {
+                    wrong += ((checkRecord *) Entry)->value < 0;
+                    Entry->release();
+                    if (++n == 32) {
+                        table->abortWalk(&cursor);
+                        break;
+                    }
+                }
+            }
+        }
+};
+
+static void checkEpoch(void)
+{
+    Table table(8, TABLE_EPOCH);
+    checkGrowth(table);
+
+    /* deleted entries aren't freed while readers may still see them
+       (which ASan would catch) */
+    Table churned(4, TABLE_EPOCH);
+    fill(churned, 64);
+    churner writer;
+    writer.table = &churned;
+    writer.stop = 0;
+    if (!writer.StartThread(false)) {
+        CHECK(!"StartThread");
+        return;
+    }
+    churnReader readers[4];
+    unsigned i, started;
+    for (started = 0; started < lengthof(readers); started++) {
+        readers[started].table = &churned;
+        if (!readers[started].StartThread(false))
+            break;
+    }
+    CHECK(started == lengthof(readers));
+    int wrong = 0;
+    for (i = 0; i < started; i++) {
+        readers[i].WaitThread();
+        wrong += readers[i].wrong;
+    }
+    __atomic_store_n(&writer.stop, 1, __ATOMIC_RELEASE);
+    writer.WaitThread();
+    CHECK(wrong == 0);
+    CHECK(countEntries(churned) == 128 && valueOf(churned, "n7") == 7 && valueOf(churned, "c7") == 7);
+}
+
+static void checkVersionedWalks(void)
+{
+    Table table(4, TABLE_SNAPSHOT);
+    int visits[100];
+    fill(table, lengthof(visits));
+    memset(visits, 0, sizeof(visits));
+
+    /* a walk sees the table as it was when it started */
+    void *cursor;
+    TableEntry *Entry = table.getFirst(&cursor);
+    CHECK(Entry != NULL);
+    if (!Entry)
+        return;
+    visits[((checkRecord *) Entry)->value]++;
+    Entry->release();
+    for (int i = 1; i < (int) lengthof(visits); i += 2) {
+        char name[32];
+        sprintf(name, "n%d", i);
+        CHECK(table.del(name));
+    }
+    table.add(newRecord("late", 0));
+    int extra = 0;
+    while ((Entry = table.getNext(&cursor))) {
+        checkRecord *r = (checkRecord *) Entry;
+        if (!strcmp(r->name, "late"))
+            extra++;
+        else
+            visits[r->value]++;
+        Entry->release();
+    }
+    int wrong = 0;
+    for (unsigned i = 0; i < lengthof(visits); i++)
+        wrong += visits[i] != 1;
+    CHECK(wrong == 0 && extra == 0);
+
+    /* while get() and later walks don't see the deleted entries */
+    CHECK(valueOf(table, "n1") == -1 && valueOf(table, "n2") == 2);
+    CHECK(countEntries(table) == 51);
+
+    /* and walks ended early keep nothing back */
+    Entry = table.getFirst(&cursor);
+    if (Entry) {
+        Entry->release();
+        table.abortWalk(&cursor);
+    }
+    CHECK(table.del("n2") && countEntries(table) == 50);
+}
+
+/* The number of entries in a walk from Entry on, counting those out of name order */
+static int countOrdered(Table &table, void **cursor, TableEntry *Entry, int *unordered)
+{
+    char last[32] = "";
+    int n = 0;
+    *unordered = 0;
+    for (; Entry; Entry = table.getNext(cursor)) {
+        *unordered += strcmp(last, Entry->name) >= 0;
+        snprintf(last, sizeof(last), "%s", Entry->name);
+        Entry->release();
+        n++;
+    }
+    return n;
+}
+
+static void checkOrdered(void)
+{
+    Table table(4, TABLE_ORDERED);
+    fill(table, 200);
+    void *cursor;
+    int unordered;
+
+    /* whole walks, ranges and prefixes in name order across the shards */
+    CHECK(countOrdered(table, &cursor, table.getFirst(&cursor), &unordered) == 200 && !unordered);
+    CHECK(countOrdered(table, &cursor, table.getFirstInRange(&cursor, "n10", "n11"), &unordered) == 11 && !unordered);
+    CHECK(countOrdered(table, &cursor, table.getFirstInRange(&cursor, NULL, "n1"), &unordered) == 1);
+    CHECK(countOrdered(table, &cursor, table.getFirstInRange(&cursor, "n98", NULL), &unordered) == 2 && !unordered);
+    CHECK(countOrdered(table, &cursor, table.getFirstWithPrefix(&cursor, "n1"), &unordered) == 111 && !unordered);
+    CHECK(table.getFirstWithPrefix(&cursor, "z") == NULL);
+
+    /* names deleted during a walk are still seen by it */
+    TableEntry *Entry = table.getFirstWithPrefix(&cursor, "n2");
+    CHECK(Entry && !strcmp(Entry->name, "n2"));
+    CHECK(table.del("n25"));
+    CHECK(countOrdered(table, &cursor, Entry, &unordered) == 11 && !unordered);
+    CHECK(countOrdered(table, &cursor, table.getFirstWithPrefix(&cursor, "n2"), &unordered) == 10);
+}
+
+static void checkBatches(void)
+{
+    Table table(4);
+    checkRecord *adds[3] = { newRecord("a", 1), newRecord("b", 2), newRecord("c", 3) };
+    bool results[5];
+
+    CHECK(table.addMany((TableEntry **) adds, 3, results) == 3);
+    CHECK(results[0] && results[1] && results[2]);
+
+    /* each item's result is where it was asked for, repeats only found once */
+    const char *names[5] = { "b", "x", "a", NULL, "b" };
+    TableEntry *got[5];
+    CHECK(table.getMany(names, 5, got) == 2);
+    CHECK(got[0] && ((checkRecord *) got[0])->value == 2 && !got[1]);
+    CHECK(got[2] && ((checkRecord *) got[2])->value == 1 && !got[3] && !got[4]);
+    for (unsigned i = 0; i < lengthof(got); i++)
+        if (got[i])
+            got[i]->release();
+
+    CHECK(table.delMany(names, 5, results) == 2);
+    CHECK(results[0] && !results[1] && results[2] && !results[3] && !results[4]);
+    CHECK(valueOf(table, "a") == -1 && valueOf(table, "b") == -1 && valueOf(table, "c") == 3);
+}
+
+static void countVisit(TableEntry *Entry, void *arg)
+{
+    int *visits = (int *) arg;
+    __atomic_add_fetch(&visits[((checkRecord *) Entry)->value], 1, __ATOMIC_RELAXED);
+}
+
+static void checkForEachParallel(void)
+{
+    Table table(4);
+    int visits[1000];
+
+    fill(table, lengthof(visits));
+    for (unsigned nthreads = 1; nthreads <= 8; nthreads *= 2) {
+        memset(visits, 0, sizeof(visits));
+        table.forEachParallel(countVisit, visits, nthreads);
+        for (unsigned i = 0; i < lengthof(visits); i++)
+            CHECK(visits[i] == 1);
+    }
+
+    Table empty;
+    memset(visits, 0, sizeof(visits));
+    empty.forEachParallel(countVisit, visits, 4);
+    CHECK(visits[0] == 0);
+}
+
+/* A record with room for short names in itself */
+class inlineRecord: public TableEntryInline<>
+{
+    public:
+        int value;
+
+        inlineRecord(int v = 0) { value = v; }
+        bool populate(void *) { return false; }
+        void print(void) { printf("%s = %d\n", name, value); }
+        TableEntry *clone(void) const { return new inlineRecord(*this); }
+};
+
+static inlineRecord *newInline(const char *name, int value)
+{
+    inlineRecord *r = new inlineRecord(value);
+    if (!r->setName(name)) {
+        delete r;
+        return NULL;
+    }
+    return r;
+}
+
+static void checkNames(void)
+{
+    Table table(2);
+    char longName[100];
+
+    /* short names are kept in inline entries, long ones malloc()d */
+    memset(longName, 'x', sizeof(longName) - 1);
+    longName[sizeof(longName) - 1] = '\0';
+    inlineRecord *small = newInline("short", 1);
+    inlineRecord *big = newInline(longName, 2);
+    CHECK(small && small->name == small->name_buf);
+    CHECK(big && big->name != big->name_buf && !strcmp(big->name, longName));
+    CHECK(small->bytes() < big->bytes());
+    CHECK(big->setName("now short") && big->name == big->name_buf);
+    CHECK(big->setName(longName) && big->name != big->name_buf);
+    TableEntry *copy = small->clone();
+    CHECK(copy->name == ((inlineRecord *) copy)->name_buf && !strcmp(copy->name, "short"));
+    copy->unref();
+    table.add(small);
+    table.add(big);
+    CHECK(small->hash == TableEntry::hashName("short"));
+
+    /* and plain entries, which are no bigger than they've always been */
+    checkRecord *plain = newRecord("short too", 4);
+    CHECK(plain && plain->name && !strcmp(plain->name, "short too"));
+    CHECK(plain->setName("shorter") && !strcmp(plain->name, "shorter"));
+    plain->unref();
+#if defined(TABLE_COMPACT_LOCKS) && !defined(LOCK_PROFILE)
+    CHECK(sizeof(TableEntry) <= 7 * sizeof(void *));
+#endif
+
+    /* names differing only after the inline part are told apart */
+    char otherName[100];
+    strcpy(otherName, longName);
+    otherName[sizeof(otherName) - 2] = 'y';
+    table.add(newInline(otherName, 3));
+    inlineRecord *r = (inlineRecord *) table.get(longName);
+    CHECK(r && r->value == 2);
+    if (r)
+        r->release();
+    r = (inlineRecord *) table.get(otherName);
+    CHECK(r && r->value == 3);
+    if (r)
+        r->release();
+    CHECK(table.get("shor") == NULL && table.get("shortt") == NULL);
+    CHECK(table.del("short") && table.get("short") == NULL);
+}
+
+/* Changes value and its negation together, under the entry lock */
+class pairWriter: public Thread
+{
+    public:
+        checkRecord *record;
+        int *negation;
+    private:
+        void main(void) {
+            for (int i = 1; i <= 100000; i++) {
+                record->acquire();
+                __atomic_store_n(&record->value, i, __ATOMIC_RELAXED);
+                __atomic_store_n(negation, -i, __ATOMIC_RELAXED);
+                record->release();
+            }
+        }
+};
+
+static void checkSeqlock(void)
+{
+    checkRecord r(0);
+
+    /* optimistic reads retry only if a writer got in */
+    unsigned seq = r.readBegin();
+    CHECK(!r.readRetry(seq));
+    r.acquire();
+    r.release();
+    CHECK(r.readRetry(seq));
+
+    /* and then never see a change half made */
+    int negation = 0;
+    pairWriter writer;
+    writer.record = &r;
+    writer.negation = &negation;
+    if (!writer.StartThread(false)) {
+        CHECK(!"StartThread");
+        return;
+    }
+    int torn = 0, value;
+    do {
+        int neg;
+        do {
+            seq = r.readBegin();
+            value = __atomic_load_n(&r.value, __ATOMIC_RELAXED);
+            neg = __atomic_load_n(&negation, __ATOMIC_RELAXED);
+        } while (r.readRetry(seq));
+        torn += value != -neg;
+    } while (value < 100000);
+    writer.WaitThread();
+    CHECK(torn == 0);
+}
+
+/* acquire()s the entry, noting when it got it */
+class entryWriter: public Thread
+{
+    public:
+        TableEntry *entry;
+        int got;
+    private:
+        void main(void) {
+            entry->acquire();
+            __atomic_store_n(&got, 1, __ATOMIC_RELEASE);
+            entry->release();
+        }
+};
+
+static void checkSharedLocks(void)
+{
+    checkRecord r(0);
+
+    /* readers share, and a writer waits for them all */
+    r.acquireShared();
+    r.acquireShared();
+    entryWriter writer;
+    writer.entry = &r;
+    writer.got = 0;
+    if (!writer.StartThread(false)) {
+        CHECK(!"StartThread");
+        r.releaseShared();
+        r.releaseShared();
+        return;
+    }
+    usleep(20000);
+    CHECK(!__atomic_load_n(&writer.got, __ATOMIC_ACQUIRE));
+    r.releaseShared();
+    usleep(20000);
+    CHECK(!__atomic_load_n(&writer.got, __ATOMIC_ACQUIRE));
+    r.releaseShared();
+    writer.WaitThread();
+    CHECK(writer.got);
+
+    /* the lock's enter() and leave() still hold the entry exclusively */
+    r.lock.enter();
+    CHECK(!r.tryAcquire());
+    r.lock.leave();
+    CHECK(r.tryAcquire());
+    r.release();
+
+    /* shared holders don't disturb optimistic readers */
+    unsigned seq = r.readBegin();
+    r.acquireShared();
+    r.releaseShared();
+    CHECK(!r.readRetry(seq));
+
+    Table table(2);
+    fill(table, 10);
+    checkRecord *s = (checkRecord *) table.getShared("n3");
+    CHECK(s && s->value == 3);
+    if (s)
+        s->releaseShared();
+}
+
+/* Reverse the bytes of the 32 bit word at offset in a dump()ed file */
+static bool swapWord(const char *path, long offset)
+{
+    FILE *f = fopen(path, "r+b");
+    unsigned char word[4], swapped[4];
+    bool ok = f && !fseek(f, offset, SEEK_SET) && fread(word, sizeof(word), 1, f) == 1;
+    for (unsigned i = 0; i < sizeof(word); i++)
+        swapped[i] = word[sizeof(word) - 1 - i];
+    ok = ok && !fseek(f, offset, SEEK_SET) && fwrite(swapped, sizeof(swapped), 1, f) == 1;
+    if (f && fclose(f))
+        ok = false;
+    return ok;
+}
+
+static void checkDumpLoad(void)
+{
+    Table table(4);
+    fill(table, 1000);
+    char path[] = "/tmp/table_checkXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        CHECK(!"mkstemp");
+        return;
+    }
+    close(fd);
+    CHECK(table.dump(path));
+
+    /* everything comes back, whether looked up, deleted or walked first */
+    Table loaded(2);
+    CHECK(loaded.load(path, newCheckRecord));
+    CHECK(valueOf(loaded, "n7") == 7);
+    CHECK(loaded.del("n8") && valueOf(loaded, "n8") == -1 && !loaded.del("n8"));
+    CHECK(valueOf(loaded, "n1000") == -1);
+    int wrong = 0, visits[1000];
+    memset(visits, 0, sizeof(visits));
+    void *cursor;
+    for (TableEntry *Entry = loaded.getFirst(&cursor); Entry; Entry = loaded.getNext(&cursor)) {
+        checkRecord *r = (checkRecord *) Entry;
+        char name[32];
+        sprintf(name, "n%d", r->value);
+        wrong += strcmp(name, r->name) != 0;
+        visits[r->value]++;
+        Entry->release();
+    }
+    for (unsigned i = 0; i < lengthof(visits); i++)
+        wrong += visits[i] != (i != 8);
+    CHECK(wrong == 0);
+
+    /* only into an empty table */
+    Table full(2);
+    fill(full, 10);
+    CHECK(!full.load(path, newCheckRecord));
+    CHECK(countEntries(full) == 10 && valueOf(full, "n7") == 7);
+
+    /* a file from another version, or the other byte order, is refused */
+    Table other;
+    CHECK(swapWord(path, 8) && !other.load(path, newCheckRecord));
+    CHECK(table.dump(path) && swapWord(path, 12) && !other.load(path, newCheckRecord));
+    CHECK(countEntries(other) == 0);
+
+    /* as is a corrupt or cut short file */
+    FILE *f = fopen(path, "r+b");
+    if (f) {
+        fputc('X', f);
+        fclose(f);
+    }
+    Table corrupt;
+    CHECK(!corrupt.load(path, newCheckRecord));
+    CHECK(table.dump(path) && truncate(path, 100) == 0);
+    CHECK(!corrupt.load(path, newCheckRecord));
+    CHECK(!corrupt.load("/nonexistent/table", newCheckRecord));
+    CHECK(countEntries(corrupt) == 0);
+    unlink(path);
+}
+
+static void checkAddLines(void)
+{
+    Table table(4);
+    char lines[] = "a 1\nb 2\n\na 3\nc 4";
+
+    /* the last of a repeated name wins, even without a final newline */
+    CHECK(table.addLines(lines, strlen(lines), newCheckRecord, 4) == 3);
+    CHECK(valueOf(table, "a") == 3 && valueOf(table, "b") == 2 && valueOf(table, "c") == 4);
+
+    /* names already in the table are kept */
+    char more[] = "b 5\nd 6\n";
+    CHECK(table.addLines(more, strlen(more), newCheckRecord, 1) == 1);
+    CHECK(valueOf(table, "b") == 2 && valueOf(table, "d") == 6);
+
+    /* enough lines to split across the threads, from a file */
+    const int count = 100000;
+    char path[] = "/tmp/table_checkXXXXXX";
+    int fd = mkstemp(path);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!f) {
+        CHECK(!"mkstemp");
+        return;
+    }
+    for (int i = 0; i < count; i++)
+        fprintf(f, "n%d %d\n", i, i);
+    fclose(f);
+    Table big(8);
+    CHECK(big.addFile(path, newCheckRecord, 4) == (unsigned) count);
+    unlink(path);
+    int wrong = 0;
+    for (int i = 0; i < count; i++) {
+        char name[32];
+        sprintf(name, "n%d", i);
+        wrong += valueOf(big, name) != i;
+    }
+    CHECK(wrong == 0);
+    CHECK(big.addFile(path, newCheckRecord, 4) == 0);
+}
+
+/* Holds an entry a while, so that others have to wait for it */
+class entryHolder: public Thread
+{
+    public:
+        TableEntry *entry;
+        int held;
+    private:
+        void main(void) {
+            entry->acquire();
+            __atomic_store_n(&held, 1, __ATOMIC_RELEASE);
+            usleep(20000);
+            entry->release();
+        }
+};
+
+static void checkLockReport(void)
+{
+    Table table;
+    checkRecord *r = newRecord("contended", 0);
+    table.add(r);
+
+    entryHolder holder;
+    holder.entry = r;
+    holder.held = 0;
+    if (!holder.StartThread(false)) {
+        CHECK(!"StartThread");
+        return;
+    }
+    while (!__atomic_load_n(&holder.held, __ATOMIC_ACQUIRE))
+        usleep(1000);
+    r->acquire();
+    r->release();
+    holder.WaitThread();
+#ifdef LOCK_PROFILE
+    CHECK(r->lock_acquires == 2 && r->lock_contended == 1 && r->lock_wait_ns > 0);
+#endif
+
+    char report[4096] = "";
+    FILE *out = tmpfile();
+    if (!out) {
+        CHECK(!"tmpfile");
+        return;
+    }
+    table.lockReport(out, 10);
+    rewind(out);
+    size_t len = fread(report, 1, sizeof(report) - 1, out);
+    report[len] = '\0';
+    fclose(out);
+#ifdef LOCK_PROFILE
+    CHECK(strstr(report, "hottest entries") && strstr(report, "contended "));
+#else
+    CHECK(strstr(report, "not built in") != NULL);
+#endif
+}
+
+static long long valueKey(const TableEntry *Entry)
+{
+    return ((const checkRecord *) Entry)->value;
+}
+
+/* The values of the entries with lo <= key <= hi, in order, or -1 if there are more than max */
+static int keyRange(Table &table, int index, long long lo, long long hi, int *values, int max)
+{
+    void *cursor;
+    int n = 0;
+    for (TableEntry *Entry = table.getFirstByKey(&cursor, index, lo, hi); Entry; Entry = table.getNext(&cursor)) {
+        if (n < max)
+            values[n] = ((checkRecord *) Entry)->value;
+        n++;
+        Entry->release();
+    }
+    return n <= max ? n : -1;
+}
+
+static void checkIndexes(void)
+{
+    Table table(4);
+    fill(table, 100);
+    int index = table.addIndex(valueKey); /* of the entries already there too */
+    CHECK(index >= 0);
+
+    int values[100];
+    CHECK(keyRange(table, index, 10, 20, values, 100) == 11);
+    for (int i = 0; i < 11; i++)
+        CHECK(values[i] == 10 + i);
+    CHECK(keyRange(table, index, 200, 300, values, 100) == 0);
+    CHECK(keyRange(table, index, 20, 10, values, 100) == 0);
+
+    /* changes only show once reindex()ed */
+    checkRecord *r = (checkRecord *) table.get("n15");
+    if (r) {
+        r->value = 1000;
+        CHECK(table.reindex(r));
+        r->release();
+    }
+    CHECK(keyRange(table, index, 10, 20, values, 100) == 10);
+    CHECK(keyRange(table, index, 1000, 1000, values, 100) == 1);
+
+    /* dels come out of the index, and duplicate keys are all found */
+    CHECK(table.del("n12"));
+    table.add(newRecord("m13", 13));
+    CHECK(keyRange(table, index, 10, 20, values, 100) == 10);
+    CHECK(keyRange(table, index, 13, 13, values, 100) == 2);
+}
+
+static void checkChangeLog(void)
+{
+    Table table(2);
+    CHECK(table.logChanges(4));
+    unsigned long long seq = table.changeSeq();
+
+    /* changes come out in the order made, numbered one after another */
+    table.add(newRecord("a", 1));
+    table.add(newRecord("b", 2));
+    checkRecord *r = (checkRecord *) table.get("a");
+    if (r) {
+        r->value = 10;
+        CHECK(table.updated(r));
+        r->release();
+    }
+    CHECK(table.del("b"));
+    TableChange changes[8];
+    static const int types[4] = { TABLE_ADDED, TABLE_ADDED, TABLE_UPDATED, TABLE_DELETED };
+    static const char *names[4] = { "a", "b", "a", "b" };
+    int i, n = table.changesSince(seq, changes, lengthof(changes));
+    CHECK(n == 4);
+    for (i = 0; i < n; i++) {
+        CHECK(i >= 4 || (changes[i].seq == seq + i + 1 && changes[i].type == types[i] &&
+                         !strcmp(changes[i].Entry->name, names[i])));
+        changes[i].Entry->unref();
+    }
+    CHECK(table.changeSeq() == seq + 4);
+
+    /* max limits how many, and the rest follow */
+    n = table.changesSince(seq, changes, 3);
+    CHECK(n == 3);
+    for (i = 0; i < n; i++)
+        changes[i].Entry->unref();
+    n = table.changesSince(seq + 3, changes, lengthof(changes));
+    CHECK(n == 1 && changes[0].type == TABLE_DELETED);
+    for (i = 0; i < n; i++)
+        changes[i].Entry->unref();
+
+    /* the ring only holds the last 4, so falling further behind means starting again */
+    table.add(newRecord("c", 3));
+    CHECK(table.changesSince(seq, changes, lengthof(changes)) == -1);
+    n = table.changesSince(seq + 1, changes, lengthof(changes));
+    CHECK(n == 4 && changes[3].type == TABLE_ADDED && !strcmp(changes[3].Entry->name, "c"));
+    for (i = 0; i < n; i++)
+        changes[i].Entry->unref();
+}
+
+static void checkCache(void)
+{
+    Table table(1);
+    TableCacheStats stats;
+    table.setCache(100, 0, 0);
+
+    /* entries found since the clock hand last passed stay */
+    table.add(newRecord("hot", 1));
+    for (int i = 0; i < 1000; i++) {
+        char name[32];
+        sprintf(name, "n%d", i);
+        table.add(newRecord(name, i));
+        CHECK(valueOf(table, "hot") == 1);
+    }
+    table.getCacheStats(&stats);
+    CHECK(stats.hits == 1000 && stats.misses == 0);
+    CHECK(stats.entries <= 101 && stats.evictions + stats.entries == 1001);
+    CHECK(valueOf(table, "n999") == 999 && valueOf(table, "n0") == -1);
+
+    /* entries expire after the table's ttl, or their own */
+    Table ttl(2);
+    ttl.setCache(0, 0, 3600);
+    checkRecord *r = newRecord("short", 1);
+    r->expireIn(0);
+    ttl.add(r);
+    ttl.add(newRecord("long", 2));
+    CHECK(valueOf(ttl, "short") == -1 && valueOf(ttl, "long") == 2);
+    ttl.getCacheStats(&stats);
+    CHECK(stats.hits == 1 && stats.misses == 1 && stats.evictions == 0);
+
+    /* a byte limit counts bytes() */
+    checkRecord *probe = newRecord("n0", 0);
+    Table bytes(1);
+    bytes.setCache(0, 10 * probe->bytes(), 0);
+    delete probe;
+    fill(bytes, 100);
+    bytes.getCacheStats(&stats);
+    CHECK(stats.entries <= 11 && stats.entries + stats.evictions == 100);
+}
+
+static int comparePointers(const void *p1, const void *p2)
+{
+    uintptr_t a = (uintptr_t) *(void * const *) p1, b = (uintptr_t) *(void * const *) p2;
+    return a < b ? -1 : a > b;
+}
+
+static void checkSlab(void)
+{
+    const size_t size = 40;
+    /* a few chunks' worth, in whole batches, so no
+       unused objects are left in the thread's cache */
+    static void *objs[160 * SLAB_BATCH], *again[160 * SLAB_BATCH];
+    slab *s = slab_new(size);
+    if (!s) {
+        CHECK(!"slab_new");
+        return;
+    }
+
+    /* objects are aligned and don't overlap */
+    unsigned i, overlapped = 0;
+    for (i = 0; i < lengthof(objs); i++) {
+        objs[i] = slab_alloc(s);
+        CHECK(objs[i] && !((uintptr_t) objs[i] & 15));
+        if (objs[i])
+            memset(objs[i], i & 0xFF, size);
+    }
+    for (i = 0; i < lengthof(objs); i++)
+        if (objs[i])
+            overlapped += ((unsigned char *) objs[i])[0] != (i & 0xFF) ||
+                          ((unsigned char *) objs[i])[size - 1] != (i & 0xFF);
+    CHECK(overlapped == 0);
+
+    /* freed objects are reused before any more are carved out */
+    for (i = 0; i < lengthof(objs); i++)
+        slab_free(s, objs[i]);
+    for (i = 0; i < lengthof(again); i++)
+        again[i] = slab_alloc(s);
+    qsort(objs, lengthof(objs), sizeof(void *), comparePointers);
+    qsort(again, lengthof(again), sizeof(void *), comparePointers);
+    CHECK(!memcmp(objs, again, sizeof(objs)));
+    slab_delete(s);
+}
+
+static void checkTypedTable(void)
+{
+    TypedTable<TableValue<int>, int> ints(4, TABLE_ORDERED);
+    int i, wrong = 0;
+    for (i = -50; i < 50; i++)
+        CHECK(ints.add(i * 1000, new TableValue<int>(i)));
+
+    /* integer keys are found again, without the others */
+    for (i = -50; i < 50; i++) {
+        TableValue<int> *v = ints.get(i * 1000);
+        wrong += !v || v->value != i || ints.keyOf(v) != i * 1000;
+        if (v)
+            v->release();
+    }
+    CHECK(wrong == 0);
+    CHECK(!ints.get(1) && !ints.get(-1) && !ints.get(50000));
+    CHECK(ints.del(-3000) && !ints.get(-3000) && !ints.del(-3000));
+
+    /* and walked in key order, negatives first */
+    TypedTable<TableValue<int>, int>::Cursor cursor;
+    int n = 0, unordered = 0, last = INT_MIN;
+    for (TableValue<int> *v = ints.getFirst(cursor); v; v = ints.getNext(cursor)) {
+        unordered += ints.keyOf(v) <= last;
+        last = ints.keyOf(v);
+        v->release();
+        n++;
+    }
+    CHECK(n == 99 && unordered == 0);
+    n = 0;
+    for (TableValue<int> *v = ints.getFirstInRange(cursor, -2000, 3000); v; v = ints.getNext(cursor)) {
+        n++;
+        v->release();
+    }
+    CHECK(n == 5);
+
+    /* ids differing only past the part kept in the entry are told apart */
+    TypedTable<TableValue<int>, TableId<16> > ids(4);
+    TableId<16> id;
+    for (i = 0; i < 100; i++) {
+        memset(id.bytes, 0, sizeof(id.bytes));
+        id.bytes[0] = i & 3;
+        id.bytes[15] = i;
+        CHECK(ids.add(id, new TableValue<int>(i)));
+    }
+    for (i = 0; i < 100; i++) {
+        memset(id.bytes, 0, sizeof(id.bytes));
+        id.bytes[0] = i & 3;
+        id.bytes[15] = i;
+        TableValue<int> *v = ids.get(id);
+        wrong += !v || v->value != i || memcmp(ids.keyOf(v).bytes, id.bytes, sizeof(id.bytes));
+        if (v)
+            v->release();
+    }
+    CHECK(wrong == 0);
+    id.bytes[15] = 200;
+    CHECK(!ids.get(id) && !ids.del(id));
+
+    /* names still work as before */
+    TypedTable<TableValue<int> > names;
+    CHECK(names.add("a", new TableValue<int>(1)));
+    TableValue<int> *v = names.get("a");
+    CHECK(v && v->value == 1 && !strcmp(names.keyOf(v), "a"));
+    if (v)
+        v->release();
+
+#if __cplusplus >= 201703L
+    /* views are found without copying, whatever their length */
+    TypedTable<TableValue<int>, std::string_view> views(4, TABLE_ORDERED);
+    std::string_view text("apple banana apricot");
+    std::string_view apple = text.substr(0, 5), apricot = text.substr(13);
+    char longName[100];
+    memset(longName, 'v', sizeof(longName) - 1);
+    longName[sizeof(longName) - 1] = '\0';
+    CHECK(views.add(apple, new TableValue<int>(1)));
+    CHECK(views.add(text.substr(6, 6), new TableValue<int>(2)));
+    CHECK(views.add(apricot, new TableValue<int>(3)));
+    CHECK(views.add(longName, new TableValue<int>(4)));
+    v = views.get(text.substr(6, 6));
+    CHECK(v && v->value == 2 && views.keyOf(v) == "banana");
+    if (v)
+        v->release();
+    v = views.get(std::string_view(longName));
+    CHECK(v && v->value == 4);
+    if (v)
+        v->release();
+    CHECK(!views.get(text.substr(0, 4)) && !views.get(text.substr(0, 6)));
+    int range = 0;
+    TypedTable<TableValue<int>, std::string_view>::Cursor vc;
+    for (v = views.getFirstInRange(vc, "ap", "aq"); v; v = views.getNext(vc)) {
+        range += v->value;
+        v->release();
+    }
+    CHECK(range == 1 + 3);
+    CHECK(views.del(apricot) && !views.get(apricot));
+#endif
+}
+
+/* Counts "shared" up through getOrCreate(), racing with the others */
+class sharedCounter: public Thread
+{
+    public:
+        Table *table;
+        int creates;
+    private:
+        void main(void) {
+            creates = 0;
+            for (int i = 0; i < 10000; i++) {
+                bool created;
+                checkRecord *r = (checkRecord *) table->getOrCreate("shared", newCheckRecord, &created);
+                if (!r)
+                    continue;
+                creates += created;
+                r->value++;
+                r->release();
+            }
+        }
+};
+
+static void mergeValues(TableEntry *Existing, TableEntry *Update)
+{
+    ((checkRecord *) Existing)->value += ((checkRecord *) Update)->value;
+}
+
+static void checkGetOrCreate(void)
+{
+    Table table(4);
+    bool created;
+
+    /* created once, and then found */
+    checkRecord *r = (checkRecord *) table.getOrCreate("a", newCheckRecord, &created);
+    CHECK(r && created && !strcmp(r->name, "a"));
+    if (r) {
+        r->value = 1;
+        r->release();
+    }
+    checkRecord *again = (checkRecord *) table.getOrCreate("a", newCheckRecord, &created);
+    CHECK(again == r && !created && again->value == 1);
+    if (again)
+        again->release();
+
+    /* threads racing to create the one name all get it */
+    sharedCounter counters[4];
+    unsigned i, started;
+    for (started = 0; started < lengthof(counters); started++) {
+        counters[started].table = &table;
+        if (!counters[started].StartThread(false))
+            break;
+    }
+    CHECK(started == lengthof(counters));
+    int creates = 0;
+    for (i = 0; i < started; i++) {
+        counters[i].WaitThread();
+        creates += counters[i].creates;
+    }
+    CHECK(creates == 1 && valueOf(table, "shared") == 10000 * (int) started);
+
+    /* upsert() adds, replaces, or merges */
+    CHECK(table.upsert(newRecord("b", 2)) && valueOf(table, "b") == 2);
+    CHECK(table.upsert(newRecord("b", 5)) && valueOf(table, "b") == 5);
+    CHECK(table.upsert(newRecord("b", 3), mergeValues) && valueOf(table, "b") == 8);
+    CHECK(table.upsert(newRecord("c", 4), mergeValues) && valueOf(table, "c") == 4);
+    CHECK(countEntries(table) == 4);
+}
+
+/* A counter bumped through peek(), without the entry lock */
+class hitRecord: public TableEntry
+{
+    public:
+        Atomic<unsigned long> hits;
+
+        bool populate(void *) { return false; }
+        void print(void) { printf("%s = %lu\n", name, hits.load()); }
+};
+
+/* peek()s "hot" and counts a hit, many times */
+class hitter: public Thread
+{
+    public:
+        Table *table;
+    private:
+        void main(void) {
+            for (int i = 0; i < 100000; i++) {
+                hitRecord *h = (hitRecord *) table->peek("hot");
+                if (h) {
+                    h->hits.add(1);
+                    h->unref();
+                }
+            }
+        }
+};
+
+static void checkAtomic(void)
+{
+    Atomic<int> a(5);
+    CHECK(a.add(3) == 8 && a.sub(10) == -2 && a.load() == -2);
+    CHECK(a.exchange(7) == -2 && a.load() == 7);
+
+    /* compareExchange() gives the current value on failure */
+    int expected = 6;
+    CHECK(!a.compareExchange(expected, 9) && expected == 7 && a.load() == 7);
+    CHECK(a.compareExchange(expected, 9) && a.load() == 9);
+
+    a.storeMax(4);
+    CHECK(a.load() == 9);
+    a.storeMax(12);
+    CHECK(a.load() == 12);
+
+    /* no hits are lost between threads */
+    Table table(2);
+    hitRecord *h = new hitRecord;
+    if (!h->setName("hot") || !table.add(h)) {
+        delete h;
+        CHECK(!"add");
+        return;
+    }
+    hitter hitters[4];
+    unsigned i, started;
+    for (started = 0; started < lengthof(hitters); started++) {
+        hitters[started].table = &table;
+        if (!hitters[started].StartThread(false))
+            break;
+    }
+    CHECK(started == lengthof(hitters));
+    for (i = 0; i < started; i++)
+        hitters[i].WaitThread();
+    CHECK(h->hits.load() == 100000UL * started);
+}
+
+static void checkShmTable(void)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/table_check_%d", (int) getpid());
+    ShmTable::remove(path);
+    ShmTable shm;
+    if (!shm.open(path, 100, sizeof(int))) {
+        CHECK(!"open");
+        return;
+    }
+    int value = 1;
+    CHECK(shm.add("parent", &value) && !shm.add("parent", &value));
+
+    /* another process sees and changes the same records */
+    fflush(stdout);
+    pid_t pid = fork();
+    if (!pid) {
+        ShmTable child;
+        int got = 0, two = 2;
+        bool ok = child.open(path, 100, sizeof(int)) &&
+                  child.get("parent", &got) && got == 1 &&
+                  child.add("child", &two);
+        int *record = (int *) child.acquire("parent");
+        if (record) {
+            (*record)++;
+            child.release(record);
+        }
+        child.close();
+        _exit(ok && record ? 0 : 1);
+    }
+    int status = 0;
+    CHECK(pid > 0 && waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(shm.get("child", &value) && value == 2);
+    CHECK(shm.get("parent", &value) && value == 2);
+    CHECK(shm.count() == 2);
+    CHECK(shm.del("child") && !shm.get("child", &value) && shm.count() == 1);
+    shm.close();
+    CHECK(ShmTable::remove(path));
+}
+
+static bool dieInWalk(const char *, void *, void *)
+{
+    _exit(0); //holding a stripe and a record
+}
+
+static bool countShm(const char *, void *, void *arg)
+{
+    (*(unsigned *) arg)++;
+    return true;
+}
+
+/* Processes dying holding the table's locks mustn't leave it wedged,
+   miscounted, or with slots lost to both the chains and free list. */
+static void checkShmCrash(void)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/table_check_crash_%d", (int) getpid());
+    ShmTable::remove(path);
+    ShmTable shm;
+    const unsigned capacity = 64;
+    if (!shm.open(path, capacity, sizeof(int))) {
+        CHECK(!"open");
+        return;
+    }
+    int value = 0;
+    CHECK(shm.add("0", &value));
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (!pid) {
+        shm.walk(dieInWalk, NULL);
+        _exit(1);
+    }
+    int status = 0;
+    CHECK(pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && !WEXITSTATUS(status));
+    CHECK(shm.get("0", &value) && value == 0); //not wedged
+
+    for (int round = 0; round < 20; round++) {
+        fflush(stdout);
+        pid = fork();
+        if (!pid) {
+            char name[16];
+            for (unsigned i = 0; ; i++) { //till killed, mid way through something
+                snprintf(name, sizeof(name), "%u", i % capacity);
+                if (!shm.add(name, &value))
+                    shm.del(name);
+            }
+        }
+        usleep(1000 + round * 100);
+        kill(pid, SIGKILL);
+        CHECK(pid > 0 && waitpid(pid, &status, 0) == pid);
+        shm.del("0"); //repairs if needed
+        unsigned walked = 0;
+        shm.walk(countShm, &walked);
+        CHECK(walked == shm.count());
+    }
+    char name[16];
+    for (unsigned i = 0; i < capacity; i++) {
+        snprintf(name, sizeof(name), "%u", i);
+        shm.put(name, &value);
+    }
+    CHECK(shm.count() == capacity); //nothing lost
+    CHECK(!shm.add("full", &value));
+    shm.close();
+    CHECK(ShmTable::remove(path));
+}
+
+static void checkSnapshot(void)
+{
+    Table table(4);
+    fill(table, 10);
+    TableSnapshot *snap = table.snapshot();
+    if (!snap) {
+        CHECK(!"snapshot");
+        return;
+    }
+
+    /* changes after the snapshot only show in the table */
+    checkRecord *r = (checkRecord *) table.getForUpdate("n3");
+    CHECK(r && r->value == 3);
+    if (r) {
+        r->value = 300;
+        r->release();
+    }
+    CHECK(table.del("n4"));
+    table.add(newRecord("new", 11));
+    CHECK(valueOf(table, "n3") == 300 && valueOf(table, "n4") == -1 && valueOf(table, "new") == 11);
+
+    CHECK(snap->size() == 10);
+    checkRecord *s = (checkRecord *) snap->get("n3");
+    CHECK(s && s->value == 3);
+    s = (checkRecord *) snap->get("n4");
+    CHECK(s && s->value == 4);
+    CHECK(snap->get("new") == NULL);
+
+    /* in name order */
+    unsigned i, unordered = 0;
+    for (i = 1; i < snap->size(); i++)
+        unordered += strcmp(snap->at(i - 1)->name, snap->at(i)->name) >= 0;
+    CHECK(unordered == 0);
+    snap->unref();
+
+    /* with no snapshot live, entries are changed in place */
+    r = (checkRecord *) table.peek("n5");
+    checkRecord *same = (checkRecord *) table.getForUpdate("n5");
+    CHECK(r && same == r);
+    if (same) {
+        same->value = 500;
+        same->release();
+    }
+    if (r)
+        r->unref();
+    CHECK(valueOf(table, "n5") == 500);
+}
+
+/* With the default clone(), so getForUpdate() changes it in place */
+class inPlaceRecord: public checkRecord
+{
+    public:
+        inPlaceRecord(int v = 0) : checkRecord(v) {}
+        TableEntry *clone(void) const { return NULL; }
+};
+
+/* Changes an entry through getForUpdate() in two steps, a while apart */
+class slowUpdater: public Thread
+{
+    public:
+        Table *table;
+        int updating;
+    private:
+        void main(void) {
+            checkRecord *r = (checkRecord *) table->getForUpdate("slow");
+            if (!r)
+                return;
+            __atomic_store_n(&updating, 1, __ATOMIC_RELEASE);
+            r->value = -1;
+            usleep(20000);
+            r->value = 2;
+            r->release();
+        }
+};
+
+static void checkSnapshotInPlace(void)
+{
+    Table table;
+    inPlaceRecord *r = new inPlaceRecord(1);
+    if (!r->setName("slow") || !table.add(r)) {
+        CHECK(!"add");
+        return;
+    }
+    TableSnapshot *snap = table.snapshot();
+    if (!snap) {
+        CHECK(!"snapshot");
+        return;
+    }
+
+    /* readers of the snapshot wait for the change rather than see half of it */
+    slowUpdater updater;
+    updater.table = &table;
+    updater.updating = 0;
+    if (!updater.StartThread(false)) {
+        CHECK(!"StartThread");
+        snap->unref();
+        return;
+    }
+    while (!__atomic_load_n(&updater.updating, __ATOMIC_ACQUIRE))
+        usleep(1000);
+    checkRecord *s = (checkRecord *) snap->getShared("slow");
+    CHECK(s == r && s->value == 2);
+    if (s)
+        s->releaseShared();
+    updater.WaitThread();
+    s = (checkRecord *) snap->atShared(0);
+    CHECK(s == r && s->value == 2);
+    s->releaseShared();
+    CHECK(snap->getShared("none") == NULL);
+    snap->unref();
+}
+
+static void checkFilter(void)
+{
+    Table table(4);
+    TableFilterStats stats;
+
+    fill(table, 500); /* before the filter, which picks them up */
+    CHECK(table.setFilter(1000) && !table.setFilter(1000));
+    fill(table, 1000); /* n500 on, and duplicates of the rest */
+
+    /* no false negatives */
+    int missing = 0;
+    for (int i = 0; i < 1000; i++) {
+        char name[32];
+        sprintf(name, "n%d", i);
+        missing += valueOf(table, name) != i;
+    }
+    CHECK(missing == 0);
+    table.getFilterStats(&stats);
+    CHECK(stats.lookups == 1000 && stats.negatives == 0 && stats.false_positives == 0);
+    CHECK(stats.bytes >= 1000 * 8);
+
+    /* and most names that aren't there are turned away */
+    for (int i = 0; i < 1000; i++) {
+        char name[32];
+        sprintf(name, "x%d", i);
+        missing += valueOf(table, name) == -1;
+    }
+    CHECK(missing == 1000);
+    table.getFilterStats(&stats);
+    CHECK(stats.lookups == 2000 && stats.negatives + stats.false_positives == 1000);
+    CHECK(stats.negatives > 900);
+
+    /* a del()eted name only goes once all its duplicates have */
+    CHECK(table.del("n7") && valueOf(table, "n7") == 7);
+    CHECK(table.del("n7") && valueOf(table, "n7") == -1);
+    CHECK(!table.del("n7"));
+}
+
+/* Sums lo..hi-1 by splitting the range into nested tasks */
+struct sumTask {
+    executor *e;
+    int lo, hi;
+    int *runs;              /* how often each number was summed */
+    long long sum;
+};
+
+static void sumRange(void *arg)
+{
+    sumTask *t = (sumTask *) arg;
+    if (t->hi - t->lo <= 16) {
+        t->sum = 0;
+        for (int i = t->lo; i < t->hi; i++) {
+            t->sum += i;
+            __atomic_add_fetch(&t->runs[i], 1, __ATOMIC_RELAXED);
+        }
+        return;
+    }
+    int mid = t->lo + (t->hi - t->lo) / 2;
+    sumTask left = { t->e, t->lo, mid, t->runs, 0 };
+    sumTask right = { t->e, mid, t->hi, t->runs, 0 };
+    executor_task *task = executor_submit(t->e, sumRange, &left);
+    sumRange(&right);
+    if (task)
+        executor_wait(task);
+    else
+        sumRange(&left);
+    t->sum = left.sum + right.sum;
+}
+
+static void countRun(void *arg)
+{
+    __atomic_add_fetch((int *) arg, 1, __ATOMIC_RELAXED);
+}
+
+static void checkExecutor(void)
+{
+    static int runs[10000];
+    executor *e = executor_new(4);
+    if (!e) {
+        CHECK(!"executor_new");
+        return;
+    }
+
+    /* tasks waiting for the tasks they submit, each run once */
+    sumTask all = { e, 0, lengthof(runs), runs, 0 };
+    executor_task *task = executor_submit(e, sumRange, &all);
+    CHECK(task != NULL);
+    if (task)
+        executor_wait(task);
+    CHECK(all.sum == (long long) lengthof(runs) * (lengthof(runs) - 1) / 2);
+    unsigned i, wrong = 0;
+    for (i = 0; i < lengthof(runs); i++)
+        wrong += runs[i] != 1;
+    CHECK(wrong == 0);
+
+    /* done once run, whether waited for or not */
+    int count = 0;
+    task = executor_submit(e, countRun, &count);
+    if (task) {
+        while (!executor_done(task))
+            sched_yield();
+        CHECK(__atomic_load_n(&count, __ATOMIC_RELAXED) == 1);
+        executor_wait(task);
+    }
+
+    /* detached tasks are still run before executor_delete() returns */
+    for (i = 0; i < 1000; i++) {
+        task = executor_submit(e, countRun, &count);
+        if (task)
+            executor_detach(task);
+        else
+            CHECK(!"executor_submit");
+    }
+    executor_delete(e);
+    CHECK(count == 1001);
+}
+
+int main(void)
+{
+    checkHashIndex();
+    checkShards();
+    checkEpoch();
+    checkVersionedWalks();
+    checkOrdered();
+    checkBatches();
+    checkForEachParallel();
+    checkNames();
+    checkSeqlock();
+    checkSharedLocks();
+    checkDumpLoad();
+    checkAddLines();
+    checkLockReport();
+    checkIndexes();
+    checkChangeLog();
+    checkCache();
+    checkSlab();
+    checkTypedTable();
+    checkGetOrCreate();
+    checkAtomic();
+    checkShmTable();
+#ifndef __SANITIZE_THREAD__ //it can't follow repair() taking 65 locks
+    checkShmCrash();
+#endif
+    checkSnapshot();
+    checkSnapshotInPlace();
+    checkFilter();
+    checkExecutor();
+
+    if (!failures)
+        printf("all checks passed\n");
+    return failures;
+}
@@ -34,7 +34,7 @@ class myRecord: public TableEntry
                 switch (curr_field) {
                 case mr_Name:
                     if (!name)
-                        name = strdup(field);
+                        setName(field);
                     break;
                 case mr_Field1: field1 = atoi(field); break;
                 case mr_Field2: field2 = atoi(field); break;
@@ -58,15 +58,16 @@ private:
         for(;;) {
             //Traverse table
             void *cursor;
-            myRecord *mr = (myRecord *) myTable.getFirst(&cursor);
+            //Only reading so other threads can read the records at the same time
+            myRecord *mr = (myRecord *) myTable.getFirstShared(&cursor);
             while (mr) {
                 printf("thread=%02d ", id); mr->print();
-                mr->release();
+                mr->releaseShared();
                 unsigned int rand_state;
                 if ((rand_r(&rand_state) % 5)==0) { /* mix it up a bit */
                    usleep(500000);
                 }
-                mr = (myRecord *) myTable.getNext(&cursor);
+                mr = (myRecord *) myTable.getNextShared(&cursor);
             }
         }
     }
@@ -0,0 +1,371 @@
+/* Copyright: Pádraig Brady 2026
+ * Summary: Typed front end to Table, keyed by strings, integers or ids
+ * License: LGPL
+ * History:
+ *     18 Oct 2026 : Initial version
+ */
+
+#ifndef _TYPED_TABLE_H
+#define _TYPED_TABLE_H
+
+/* A typed front end to Table, for when the entries are all of one type
+   and are looked up by something other than a C string.
+
+     struct conn : TableEntry { ... };
+     TypedTable<conn, unsigned> conns(16);
+
+     conns.add(id, new conn);
+     if (conn *c = conns.get(id)) {
+         c->bytes += len;
+         c->release();
+     }
+
+   The key is turned into the entry's name by TableKey<Key>, which is
+   resolved at compile time. Integers and TableIds are encoded in a few
+   characters rather than printed, and they sort in key order, so
+   getFirstInRange() works on TABLE_ORDERED tables. Integer names are at
+   most 11 characters, so entries derived from TableEntryInline<> (like
+   TableValue) keep them in the entry itself, as they do those of TableIds
+   of up to 23 bytes, but longer ones are malloc()d.
+
+   Integer and TableId keys aren't made into names just to look them up
+   though. They're hashed directly, and integers (and the first 8 bytes
+   of ids) are kept in the entry's extra->key, so get(), getShared(), peek()
+   and del() just compare those, and the rest of longer ids with the name,
+   without any strcmp(). Built as C++17 or later, std::string_view keys
+   are looked up without copying them too, comparing their lengths first.
+
+   Note entries are still TableEntrys, created by the caller, so values
+   are never stored in the table by value. TableValue just saves writing
+   an entry class. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#include "table.h"
+
+/* The key traits. Specialize this to use other types of key:
+     NAME_SIZE - the most chars name() needs, including the NUL
+     MALLOCS   - 1 if name() can malloc() longer names, which it returns
+                 NULL for if out of memory
+     name()    - the name for key, made in buf if need be
+     key()     - the key of a name made by name()
+   and either derive from TableNameKey, so lookups go by name, or set
+     MATCH     - 1, to look keys up with Table::getMatch() and co
+     hash()    - the hash of a key
+     hashName()- the same, from its name
+     keyOf()   - the value for TableEntryExtra::key, from its name
+     match()   - whether the entry is the one for key, which is a const Key * */
+template <typename Key> struct TableKey;
+
+struct TableNameKey
+{
+    enum { MATCH = 0, MALLOCS = 0 };
+    template <typename Key> static unsigned hash(const Key &) { return 0; }
+    static unsigned hashName(const char *name) { return TableEntry::hashName(name); }
+    static unsigned long long keyOf(const char *) { return 0; }
+    static bool match(const TableEntry *, const void *) { return false; }
+};
+
+template <> struct TableKey<const char *> : TableNameKey
+{
+    enum { NAME_SIZE = 1 };
+    static const char *name(const char *key, char *) { return key; }
+    static const char *key(const char *name) { return name; }
+};
+
+/* Names are made of 6 bit digits from '0' to 'o', most significant
+   first, so they compare with strcmp() as the keys would. */
+#define TABLE_KEY_DIGITS(bits) (((bits) + 5) / 6)
+
+/* Spread the bits of an integer key over the hash, as the
+   table's buckets use the low bits and its shards the high ones */
+static inline unsigned tableKeyMix(unsigned long long u)
+{
+    u ^= u >> 33;
+    u *= 0xff51afd7ed558ccdULL;
+    u ^= u >> 33;
+    u *= 0xc4ceb9fe1a85ec53ULL;
+    u ^= u >> 33;
+    return (unsigned) u;
+}
+
+template <typename Int> struct TableIntKey
+{
+    enum {
+        MATCH = 1,
+        MALLOCS = 0,
+        BITS = sizeof(Int) * 8,
+        NAME_SIZE = TABLE_KEY_DIGITS(sizeof(Int) * 8) + 1
+    };
+    static unsigned long long bias(void) {
+        /* flip the sign bit of signed types so negatives sort first */
+        return (Int) -1 < (Int) 0 ? 1ULL << (BITS - 1) : 0;
+    }
+    static unsigned long long mask(void) {
+        return BITS < 64 ? (1ULL << (BITS % 64)) - 1 : ~0ULL;
+    }
+    static const char *name(Int key, char *buf) {
+        unsigned long long u = ((unsigned long long) key & mask()) ^ bias();
+        for (int i = NAME_SIZE - 2; i >= 0; i--) {
+            buf[i] = '0' + (char) (u & 63);
+            u >>= 6;
+        }
+        buf[NAME_SIZE - 1] = '\0';
+        return buf;
+    }
+    static Int key(const char *name) {
+        unsigned long long u = 0;
+        for (int i = 0; i < NAME_SIZE - 1; i++)
+            u = (u << 6) | (unsigned) (name[i] - '0');
+        return (Int) ((u ^ bias()) & mask());
+    }
+    static unsigned hash(Int key) { return tableKeyMix((unsigned long long) key); }
+    static unsigned hashName(const char *name) { return hash(key(name)); }
+    static unsigned long long keyOf(const char *name) { return (unsigned long long) key(name); }
+    static bool match(const TableEntry *entry, const void *key) {
+        return entry->extra->key == (unsigned long long) *(const Int *) key;
+    }
+};
+
+template <> struct TableKey<char> : TableIntKey<char> {};
+template <> struct TableKey<signed char> : TableIntKey<signed char> {};
+template <> struct TableKey<unsigned char> : TableIntKey<unsigned char> {};
+template <> struct TableKey<short> : TableIntKey<short> {};
+template <> struct TableKey<unsigned short> : TableIntKey<unsigned short> {};
+template <> struct TableKey<int> : TableIntKey<int> {};
+template <> struct TableKey<unsigned> : TableIntKey<unsigned> {};
+template <> struct TableKey<long> : TableIntKey<long> {};
+template <> struct TableKey<unsigned long> : TableIntKey<unsigned long> {};
+template <> struct TableKey<long long> : TableIntKey<long long> {};
+template <> struct TableKey<unsigned long long> : TableIntKey<unsigned long long> {};
+
+/* A fixed size binary id, like a UUID or a hash */
+template <unsigned N> struct TableId
+{
+    unsigned char bytes[N];
+};
+
+template <unsigned N> struct TableKey<TableId<N> >
+{
+    enum {
+        MATCH = 1,
+        MALLOCS = 0,
+        NAME_SIZE = TABLE_KEY_DIGITS(N * 8) + 1
+    };
+    static const char *name(const TableId<N> &key, char *buf) {
+        unsigned acc = 0, bits = 0, d = 0;
+        for (unsigned i = 0; i < N; i++) {
+            acc = (acc << 8) | key.bytes[i];
+            bits += 8;
+            while (bits >= 6) {
+                bits -= 6;
+                buf[d++] = '0' + (char) ((acc >> bits) & 63);
+            }
+        }
+        if (bits)
+            buf[d++] = '0' + (char) ((acc << (6 - bits)) & 63);
+        buf[d] = '\0';
+        return buf;
+    }
+    static TableId<N> key(const char *name) {
+        TableId<N> id;
+        unsigned acc = 0, bits = 0, b = 0;
+        for (unsigned d = 0; b < N; d++) {
+            acc = (acc << 6) | (unsigned) (name[d] - '0');
+            bits += 6;
+            if (bits >= 8) {
+                bits -= 8;
+                id.bytes[b++] = (unsigned char) (acc >> bits);
+            }
+        }
+        return id;
+    }
+    /* The first 8 bytes, big endian */
+    static unsigned long long head(const TableId<N> &key) {
+        unsigned long long u = 0;
+        for (unsigned i = 0; i < N && i < 8; i++)
+            u = (u << 8) | key.bytes[i];
+        return u;
+    }
+    static unsigned hash(const TableId<N> &key) {
+        if (N <= 8)
+            return tableKeyMix(head(key));
+        unsigned hash = 2166136261U; /* FNV-1a */
+        for (unsigned i = 0; i < N; i++) {
+            hash ^= key.bytes[i];
+            hash *= 16777619U;
+        }
+        return hash;
+    }
+    static unsigned hashName(const char *name) { return hash(key(name)); }
+    static unsigned long long keyOf(const char *name) { return head(key(name)); }
+    static bool match(const TableEntry *entry, const void *k) {
+        const TableId<N> &key = *(const TableId<N> *) k;
+        if (entry->extra->key != head(key))
+            return false;
+        /* and the rest from the name, a byte at a time */
+        unsigned acc = 0, bits = 0, b = 0;
+        for (unsigned d = 0; N > 8 && b < N; d++) {
+            acc = (acc << 6) | (unsigned) (entry->name[d] - '0');
+            bits += 6;
+            if (bits >= 8) {
+                bits -= 8;
+                if ((unsigned char) (acc >> bits) != key.bytes[b++])
+                    return false;
+            }
+        }
+        return true;
+    }
+};
+
+#if __cplusplus >= 201703L
+/* Views are names, but needn't be NUL terminated, so names are made for
+   add()s and ranges, on the stack if short. Lookups hash the view itself
+   and compare lengths, kept as the entry's key, before the bytes. Names
+   can't have a '\0' in them, so neither can these keys. */
+template <> struct TableKey<std::string_view>
+{
+    enum {
+        MATCH = 1,
+        MALLOCS = 1,
+        NAME_SIZE = TABLE_NAME_INLINE
+    };
+    static const char *name(std::string_view key, char *buf) {
+        char *name = key.size() < NAME_SIZE ? buf : (char *) malloc(key.size() + 1);
+        if (name) {
+            key.copy(name, key.size());
+            name[key.size()] = '\0';
+        }
+        return name;
+    }
+    static std::string_view key(const char *name) { return name; }
+    static unsigned hash(std::string_view key) {
+        unsigned hash = 2166136261U; /* as TableEntry::hashName() */
+        for (size_t i = 0; i < key.size(); i++) {
+            hash ^= (unsigned char) key[i];
+            hash *= 16777619U;
+        }
+        return hash;
+    }
+    static unsigned hashName(const char *name) { return TableEntry::hashName(name); }
+    static unsigned long long keyOf(const char *name) { return strlen(name); }
+    static bool match(const TableEntry *entry, const void *k) {
+        std::string_view key = *(const std::string_view *) k;
+        return entry->extra->key == key.size() && !key.compare(0, key.size(), entry->name, key.size());
+    }
+};
+#endif
+
+/* An entry that just holds a Value, for when you
+   don't need populate() and print() or your own locking */
+template <typename Value> struct TableValue : TableEntryInline<>
+{
+    Value value;
+
+    TableValue() : value() {}
+    TableValue(const Value &v) : value(v) {}
+    bool populate(void *) { return false; }
+    void print(void) { printf("%s\n", name); }
+};
+
+template <typename Entry, typename Key = const char *>
+class TypedTable
+{
+  public:
+    typedef TableKey<Key> Traits;
+
+    /* Walk position, as the void* cursor for Table */
+    struct Cursor {
+        void *pos;
+        Cursor() : pos(NULL) {}
+    };
+
+    /* The name of a key, while it's in scope. NULL if out of memory */
+    struct KeyName {
+        char buf[Traits::NAME_SIZE];
+        const char *name;
+        KeyName(const Key &key) { name = Traits::name(key, buf); }
+        ~KeyName() {
+            if (Traits::MALLOCS && name != buf)
+                free((char *) name);
+        }
+    };
+
+    TypedTable(unsigned Shards = 1, unsigned Flags = 0) : table(Shards, Flags) {
+        if (Traits::MATCH)
+            table.setKeys(Traits::hashName, Traits::keyOf);
+    }
+
+    /* Sets the entry's name from key */
+    bool add(const Key &key, Entry *entry) {
+        KeyName n(key);
+        if (!n.name || !entry->setName(n.name))
+            return false;
+        return table.add(entry);
+    }
+    /* See Table::getOrCreate() and Table::upsert() */
+    Entry *getOrCreate(const Key &key, TableEntryFactory factory, bool *created = NULL) {
+        KeyName n(key);
+        return static_cast<Entry *>(table.getOrCreate(n.name, factory, created));
+    }
+    bool upsert(const Key &key, Entry *entry, TableMergeFunc merge = NULL) {
+        KeyName n(key);
+        if (!n.name || !entry->setName(n.name))
+            return false;
+        return table.upsert(entry, merge);
+    }
+    /* By key where the traits allow, except in load()ed
+       tables whose entries can only be faulted in by name */
+    Entry *get(const Key &key) {
+        if (Traits::MATCH && !table.mapped())
+            return static_cast<Entry *>(table.getMatch(&key, Traits::hash(key), Traits::match));
+        KeyName n(key);
+        return n.name ? static_cast<Entry *>(table.get(n.name)) : NULL;
+    }
+    Entry *getShared(const Key &key) {
+        if (Traits::MATCH && !table.mapped())
+            return static_cast<Entry *>(table.getMatchShared(&key, Traits::hash(key), Traits::match));
+        KeyName n(key);
+        return n.name ? static_cast<Entry *>(table.getShared(n.name)) : NULL;
+    }
+    Entry *peek(const Key &key) {
+        if (Traits::MATCH && !table.mapped())
+            return static_cast<Entry *>(table.peekMatch(&key, Traits::hash(key), Traits::match));
+        KeyName n(key);
+        return n.name ? static_cast<Entry *>(table.peek(n.name)) : NULL;
+    }
+    bool del(const Key &key) {
+        if (Traits::MATCH && !table.mapped())
+            return table.delMatch(&key, Traits::hash(key), Traits::match);
+        KeyName n(key);
+        return n.name && table.del(n.name);
+    }
+
+    Entry *getFirst(Cursor &cursor) { return static_cast<Entry *>(table.getFirst(&cursor.pos)); }
+    Entry *getNext(Cursor &cursor) { return static_cast<Entry *>(table.getNext(&cursor.pos)); }
+    Entry *getFirstShared(Cursor &cursor) { return static_cast<Entry *>(table.getFirstShared(&cursor.pos)); }
+    Entry *getNextShared(Cursor &cursor) { return static_cast<Entry *>(table.getNextShared(&cursor.pos)); }
+    /* Only for TABLE_ORDERED tables, the entries with lo <= key < hi */
+    Entry *getFirstInRange(Cursor &cursor, const Key &lo, const Key &hi, bool shared = false) {
+        KeyName l(lo), h(hi);
+        if (!l.name || !h.name)
+            return NULL;
+        return static_cast<Entry *>(table.getFirstInRange(&cursor.pos, l.name, h.name, shared));
+    }
+    void abortWalk(Cursor &cursor) { table.abortWalk(&cursor.pos); }
+    void resumeWalk(Cursor &cursor) { table.resumeWalk(&cursor.pos); }
+
+    static Key keyOf(const Entry *entry) { return Traits::key(entry->name); }
+
+    /* For everything else */
+    Table &base(void) { return table; }
+
+  private:
+    Table table;
+};
+
+#endif //_TYPED_TABLE_H